@@ -0,0 +1,462 @@
+/*
+ * Copyright (c) 2001 QUALCOMM Incorporated.  All rights reserved.
+ * The file license.txt specifies the terms for use, modification,
+ * and redistribution.
+ *
+ * Client access rules for the standalone daemon ($QPOP_ACL), kept in
+ * a prefix trie over IPv4 and IPv6 addresses.  See acl_load().
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/errno.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h> /* this needs to be after other .h files */
+
+#include "config.h"
+#include "popper.h"
+#include "snprintf.h"
+#include "logit.h"
+#include "scoreboard.h"
+#include "standalone.h"
+#include "acl.h"
+#include "sched_class.h"
+
+#if HAVE_UNISTD_H
+#  include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_SYS_UNISTD_H
+#  include <sys/unistd.h>
+#endif /* HAVE_SYS_UNISTD_H */
+
+#ifdef HAVE_FCNTL_H
+#  include <fcntl.h>
+#endif /* HAVE_FCNTL_H */
+
+#ifdef HAVE_SYS_FCNTL_H
+#  include <sys/fcntl.h>
+#endif /* HAVE_SYS_FCNTL_H */
+
+
+#ifdef STANDALONE
+
+/*
+ * Globals
+ */
+acl_table      *acl             = NULL; /* client access rules */
+
+
+/*
+ * Prefix trie used for the client address lists.  Nodes live in one
+ * array and refer to each other by index, so a lookup walks a compact
+ * block of memory rather than chasing pointers around the heap.  IPv4
+ * and IPv6 prefixes hang off separate roots, which keeps IPv4 lookups
+ * to at most 32 steps.
+ */
+int
+trie_node ( ptrie *t )
+{
+    ptrie_node *nn = NULL;
+    int         n  = 0;
+
+
+    if ( t->nnodes == t->maxnodes )
+    {
+        n  = ( t->maxnodes == 0 ? 64 : t->maxnodes * 2 );
+        nn = realloc ( t->nodes, n * sizeof(ptrie_node) );
+        if ( nn == NULL )
+            return -1;
+        t->nodes    = nn;
+        t->maxnodes = n;
+    }
+
+    n = t->nnodes++;
+    t->nodes [ n ].child [ 0 ] = -1;
+    t->nodes [ n ].child [ 1 ] = -1;
+    t->nodes [ n ].value       = -1;
+    return n;
+}
+
+
+/*
+ * Inserts prefix 'key'/'bits' (an IPv4 address if 'len' is 4, IPv6
+ * if 16) with 'value'.  A later insert of the same prefix replaces
+ * the value.  Returns 0, or -1 if out of memory.
+ */
+int
+trie_insert ( ptrie *t, const unsigned char *key, int len, int bits,
+              int value )
+{
+    int *root = ( len == 4 ? &t->root4 : &t->root6 );
+    int  node = 0;
+    int  b    = 0;
+    int  i    = 0;
+    int  n    = 0;
+
+
+    if ( *root == -1 && ( *root = trie_node ( t ) ) == -1 )
+        return -1;
+
+    node = *root;
+    for ( i = 0; i < bits; i++ )
+    {
+        b = ( key [ i / 8 ] >> ( 7 - i % 8 ) ) & 1;
+        if ( t->nodes [ node ].child [ b ] == -1 )
+        {
+            n = trie_node ( t );   /* may move t->nodes */
+            if ( n == -1 )
+                return -1;
+            t->nodes [ node ].child [ b ] = n;
+        }
+        node = t->nodes [ node ].child [ b ];
+    }
+
+    t->nodes [ node ].value = value;
+    return 0;
+}
+
+
+/*
+ * Returns the value of the longest prefix matching 'key', or -1.
+ */
+int
+trie_lookup ( ptrie *t, const unsigned char *key, int len )
+{
+    int node  = ( len == 4 ? t->root4 : t->root6 );
+    int value = -1;
+    int i     = 0;
+
+
+    for ( i = 0; node != -1; i++ )
+    {
+        if ( t->nodes [ node ].value != -1 )
+            value = t->nodes [ node ].value;
+        if ( i == len * 8 )
+            break;
+        node = t->nodes [ node ].child [ ( key [ i / 8 ] >> ( 7 - i % 8 ) ) & 1 ];
+    }
+
+    return value;
+}
+
+
+/*
+ * Parses "addr[/bits]" into 'key'.  Returns the key length (4 or 16),
+ * or -1 if it isn't a valid prefix.
+ */
+int
+parse_prefix ( const char *text, unsigned char *key, int *bits )
+{
+    char    buf [ 64 ];
+    char   *slash = NULL;
+    char   *end   = NULL;
+    int     len   = 0;
+
+
+    if ( strlen ( text ) >= sizeof(buf) )
+        return -1;
+    strcpy ( buf, text );
+
+    slash = strchr ( buf, '/' );
+    if ( slash != NULL )
+        *slash++ = '\0';
+
+    if ( inet_pton ( AF_INET, buf, key ) == 1 )
+        len = 4;
+    else
+    if ( inet_pton ( AF_INET6, buf, key ) == 1 )
+        len = 16;
+    else
+        return -1;
+
+    *bits = len * 8;
+    if ( slash != NULL )
+    {
+        *bits = (int) strtol ( slash, &end, 10 );
+        if ( *slash == '\0' || *end != '\0' || *bits < 0 || *bits > len * 8 )
+            return -1;
+    }
+    return len;
+}
+
+
+/*
+ * Returns the address of 'sa' as a trie key, unwrapping IPv4-mapped
+ * IPv6 addresses so they match IPv4 rules.  Returns the key length,
+ * or -1 for other families.
+ */
+int
+addr_key ( struct sockaddr *sa, unsigned char *key )
+{
+    static const unsigned char mapped [ 12 ] =
+        { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+    unsigned char *a6 = NULL;
+
+
+    if ( sa->sa_family == AF_INET )
+    {
+        memcpy ( key, &( (struct sockaddr_in *) sa )->sin_addr, 4 );
+        return 4;
+    }
+
+    if ( sa->sa_family == AF_INET6 )
+    {
+        a6 = (unsigned char *) &( (struct sockaddr_in6 *) sa )->sin6_addr;
+        if ( memcmp ( a6, mapped, sizeof(mapped) ) == 0 )
+        {
+            memcpy ( key, a6 + 12, 4 );
+            return 4;
+        }
+        memcpy ( key, a6, 16 );
+        return 16;
+    }
+
+    return -1;
+}
+
+
+/*
+ * Frees an access table
+ */
+void
+acl_free ( acl_table *tbl )
+{
+    if ( tbl == NULL )
+        return;
+    free ( tbl->trie.nodes );
+    free ( tbl->rules );
+    free ( tbl );
+}
+
+
+/*
+ * Reads the access file.  Each line is "allow <prefix>" or
+ * "deny <prefix>"; an allow line may end with "class=<name>" to give
+ * those clients a scheduling class (see class_load()).  Blank lines
+ * and '#' comments are ignored.  Returns
+ * the new table, or NULL (after logging why) if the file can't be
+ * read or has errors.
+ */
+acl_table *
+acl_load ( const char *path )
+{
+    FILE       *fp     = NULL;
+    acl_table  *tbl    = NULL;
+    acl_rule   *nr     = NULL;
+    char        line   [ 256 ];
+    char        action [ 16 ];
+    char        prefix [ 64 ];
+    char        extra  [ 48 ];
+    char        more   [ 16 ];
+    unsigned char key  [ 16 ];
+    int         cls    = -1;
+    int         bits   = 0;
+    int         len    = 0;
+    int         lineno = 0;
+    BOOL        bad    = FALSE;
+
+
+    fp = fopen ( path, "r" );
+    if ( fp == NULL )
+    {
+        err_msg ( HERE, "Unable to open access file \"%s\"", path );
+        return NULL;
+    }
+
+    tbl = calloc ( 1, sizeof(acl_table) );
+    if ( tbl == NULL )
+    {
+        fclose ( fp );
+        err_msg ( HERE, "unable to allocate memory" );
+        return NULL;
+    }
+    tbl->trie.root4 = tbl->trie.root6 = -1;
+
+    while ( fgets ( line, sizeof(line), fp ) != NULL )
+    {
+        lineno++;
+        if ( strchr ( line, '#' ) != NULL )
+            *strchr ( line, '#' ) = '\0';
+
+        *action = *prefix = *extra = *more = '\0';
+        if ( sscanf ( line, "%15s %63s %47s %15s",
+                      action, prefix, extra, more ) < 1 )
+            continue; /* blank */
+
+        if ( *more != '\0' )
+        {
+            msg ( HERE, "%s line %d: unexpected \"%s\" at end of rule",
+                  path, lineno, more );
+            bad = TRUE;
+            break;
+        }
+
+        len = parse_prefix ( prefix, key, &bits );
+        if ( len == -1 ||
+             ( strcmp ( action, "allow" ) != 0 && strcmp ( action, "deny" ) != 0 ) )
+        {
+            msg ( HERE, "%s line %d: expected \"allow|deny <addr>[/<bits>]\"",
+                  path, lineno );
+            bad = TRUE;
+            break;
+        }
+
+        cls = -1;
+        if ( *extra != '\0' )
+        {
+            if ( strncmp ( extra, "class=", 6 ) != 0 )
+                msg ( HERE, "%s line %d: expected \"class=<name>\", not \"%s\"",
+                      path, lineno, extra );
+            else
+            if ( *action != 'a' )
+                msg ( HERE, "%s line %d: class= not allowed on deny",
+                      path, lineno );
+            else
+            {
+                cls = class_find ( extra + 6 );
+                if ( cls == -1 )
+                    msg ( HERE, "%s line %d: unknown scheduling class \"%s\"",
+                          path, lineno, extra + 6 );
+            }
+
+            if ( cls == -1 )
+            {
+                bad = TRUE;
+                break;
+            }
+        }
+
+        if ( tbl->nrules % 16 == 0 )
+        {
+            nr = realloc ( tbl->rules, ( tbl->nrules + 16 ) * sizeof(acl_rule) );
+            if ( nr == NULL )
+            {
+                err_msg ( HERE, "unable to allocate memory" );
+                bad = TRUE;
+                break;
+            }
+            tbl->rules = nr;
+        }
+
+        nr = &tbl->rules [ tbl->nrules ];
+        nr->allow = ( *action == 'a' );
+        nr->cls   = cls;
+        nr->hits  = 0;
+        Qsnprintf ( nr->text, sizeof(nr->text), "%s %s%s%s", action, prefix,
+                    ( *extra != '\0' ? " " : "" ), extra );
+
+        if ( trie_insert ( &tbl->trie, key, len, bits, tbl->nrules ) == -1 )
+        {
+            err_msg ( HERE, "unable to allocate memory" );
+            bad = TRUE;
+            break;
+        }
+        tbl->nrules++;
+    }
+
+    fclose ( fp );
+    if ( bad )
+    {
+        acl_free ( tbl );
+        return NULL;
+    }
+
+    TRACE ( trace_file, POP_DEBUG, HERE,
+            "loaded %d access rules (%d trie nodes) from \"%s\"",
+            tbl->nrules, tbl->trie.nnodes, path );
+    return tbl;
+}
+
+
+/*
+ * Logs the hit count of every rule.
+ */
+void
+acl_report ( acl_table *tbl )
+{
+    int i = 0;
+
+
+    if ( tbl == NULL )
+        return;
+
+    msg ( HERE, "access: %lu allowed, %lu denied",
+          tbl->allowed, tbl->denied );
+    for ( i = 0; i < tbl->nrules; i++ )
+        msg ( HERE, "access: %-40s %lu hits",
+              tbl->rules [ i ].text, tbl->rules [ i ].hits );
+}
+
+
+/*
+ * (Re)loads the access file named by $QPOP_ACCESS.  The new table only
+ * replaces the current one if it loads cleanly, so a bad edit leaves
+ * the old rules in force.
+ */
+void
+acl_reload ( void )
+{
+    acl_table *tbl  = NULL;
+    char      *path = getenv ( "QPOP_ACCESS" );
+
+
+    if ( path == NULL || *path == '\0' )
+        return;
+
+    tbl = acl_load ( path );
+    if ( tbl == NULL )
+    {
+        msg ( HERE, "keeping previous access rules" );
+        return;
+    }
+
+    acl_report ( acl );
+    acl_free   ( acl );
+    acl = tbl;
+    msg ( HERE, "loaded %d access rules from \"%s\"", acl->nrules, path );
+}
+
+
+/*
+ * Checks a client address against the access rules.  The longest
+ * matching prefix decides; addresses matching no rule are allowed.
+ * '*cls' is set to the matching rule's scheduling class, or -1.
+ */
+BOOL
+acl_permit ( struct sockaddr *sa, int *cls )
+{
+    unsigned char key [ 16 ];
+    int           len  = 0;
+    int           rule = -1;
+
+
+    if ( acl == NULL )
+        return TRUE;
+
+    len = addr_key ( sa, key );
+    if ( len != -1 )
+        rule = trie_lookup ( &acl->trie, key, len );
+
+    if ( rule != -1 )
+    {
+        acl->rules [ rule ].hits++;
+        *cls = acl->rules [ rule ].cls;
+        if ( acl->rules [ rule ].allow == FALSE )
+        {
+            acl->denied++;
+            if ( sb_hdr != NULL )
+                SB_COUNT ( sb_hdr, acl_denied, 1 );
+            return FALSE;
+        }
+    }
+
+    acl->allowed++;
+    return TRUE;
+}
+
+#endif /* STANDALONE */
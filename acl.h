@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2001 QUALCOMM Incorporated.  All rights reserved.
+ * The file license.txt specifies the terms for use, modification,
+ * and redistribution.
+ *
+ * Client access rules for the standalone daemon ($QPOP_ACL), kept in
+ * a prefix trie over IPv4 and IPv6 addresses.  See acl_load().
+ */
+
+#ifndef _ACL_H
+#define _ACL_H
+
+/*
+ * Binary prefix trie over IPv4 and IPv6 addresses (see trie_insert()).
+ */
+typedef struct
+{
+    int     child [ 2 ];            /* node indices, or -1 */
+    int     value;                  /* payload of prefix ending here, or -1 */
+} ptrie_node;
+
+typedef struct
+{
+    ptrie_node *nodes;
+    int         nnodes;
+    int         maxnodes;
+    int         root4;
+    int         root6;
+} ptrie;
+
+
+/*
+ * Client access rules, checked by the master right after accept()
+ */
+typedef struct
+{
+    BOOL            allow;
+    int             cls;            /* scheduling class, or -1 */
+    char            text [ 128 ];   /* as written, for reports */
+    unsigned long   hits;
+} acl_rule;
+
+typedef struct
+{
+    ptrie           trie;           /* value is index into rules */
+    acl_rule       *rules;
+    int             nrules;
+    unsigned long   allowed;
+    unsigned long   denied;
+} acl_table;
+
+
+extern acl_table   *acl;
+
+int     trie_node    ( ptrie *t );
+int     trie_insert  ( ptrie *t, const unsigned char *key, int len, int bits,
+                       int value );
+int     trie_lookup  ( ptrie *t, const unsigned char *key, int len );
+int     parse_prefix ( const char *text, unsigned char *key, int *bits );
+int     addr_key     ( struct sockaddr *sa, unsigned char *key );
+acl_table *acl_load  ( const char *path );
+void    acl_free     ( acl_table *tbl );
+void    acl_report   ( acl_table *tbl );
+void    acl_reload   ( void );
+BOOL    acl_permit   ( struct sockaddr *sa, int *cls );
+
+#endif /* _ACL_H */
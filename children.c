@@ -0,0 +1,522 @@
+/*
+ * Copyright (c) 2001 QUALCOMM Incorporated.  All rights reserved.
+ * The file license.txt specifies the terms for use, modification,
+ * and redistribution.
+ *
+ * The standalone daemon's table of live session children, and the
+ * session time limit ($QPOP_MAX_SESSION) enforced on them from a timer
+ * wheel.  See limits_init().
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h> /* this needs to be after other .h files */
+
+#include "config.h"
+#include "popper.h"
+#include "snprintf.h"
+#include "logit.h"
+#include "scoreboard.h"
+#include "standalone.h"
+#include "children.h"
+#include "sched_class.h"
+
+#if HAVE_UNISTD_H
+#  include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_SYS_UNISTD_H
+#  include <sys/unistd.h>
+#endif /* HAVE_SYS_UNISTD_H */
+
+#ifdef HAVE_FCNTL_H
+#  include <fcntl.h>
+#endif /* HAVE_FCNTL_H */
+
+#ifdef HAVE_SYS_FCNTL_H
+#  include <sys/fcntl.h>
+#endif /* HAVE_SYS_FCNTL_H */
+
+
+#ifdef STANDALONE
+
+/*
+ * Globals
+ */
+child_info     *children        = NULL; /* live session children */
+int             nchildren       = 0;
+int             maxchildren     = 0;
+int            *child_buckets   = NULL; /* pid hash; maxchildren chains */
+int             nadopted        = 0;    /* children that are adopted */
+long            max_session     = 0;    /* seconds; 0 = no limit */
+long            kill_grace      = 0;    /* SIGTERM to SIGKILL */
+int             wheel [ WHEEL_LEVELS * WHEEL_SIZE ];    /* list heads */
+time_t          wheel_now       = 0;    /* the wheel has run up to here */
+unsigned long   limit_kills     = 0;    /* SIGTERMs */
+unsigned long   forced_kills    = 0;    /* SIGKILLs */
+
+
+/*
+ * A restarted acceptor takes on the sessions its predecessor left
+ * running, so they still count against their listener's and class's
+ * budgets and are held to the session limit.  They are found in the
+ * scoreboard: live slots in our share (see sb_claim()) hold the pid,
+ * listener, class and start time of each.  A session whose child
+ * hadn't yet taken its slot when the acceptor died can't be found, and
+ * without a scoreboard none can; those run on unaccounted until they
+ * end.
+ *
+ * The children aren't ours, so they are reaped by the supervisor (a
+ * subreaper on Linux) or init; adopted_poll() notices when they end.
+ */
+void
+sb_adopt ( void )
+{
+    sb_slot_t      *sp    = NULL;
+    struct timeval  start;
+    int             i     = 0;
+    int             lst   = 0;
+    int             cls   = 0;
+    int             n     = 0;
+
+
+    if ( sb_hdr == NULL )
+        return;
+
+    for ( i = acceptor_id; i < sb_nslots; i += nacceptors )
+    {
+        sp = SB_SLOT ( sb_hdr, i );
+        if ( sp->s.state != SB_RUNNING || sp->s.pid <= 0 ||
+             ( kill ( (pid_t) sp->s.pid, 0 ) == -1 && errno == ESRCH ) )
+            continue;
+
+        lst = sp->s.lst;
+        cls = sp->s.cls;
+        if ( lst < 0 || lst >= nlisteners )
+            lst = -1;
+        if ( cls < 0 || cls >= nclasses )
+            cls = 0;
+        start.tv_sec  = sp->s.started;
+        start.tv_usec = 0;
+
+        child_add ( (pid_t) sp->s.pid, i, lst, cls, &start );
+        n++;
+    }
+
+    if ( n > 0 )
+        msg ( HERE, "acceptor %d: adopted %d running sessions", acceptor_id, n );
+}
+
+
+/*
+ * Remembers a newly forked child, or, given its 'start' time, one
+ * adopted by sb_adopt()
+ */
+void
+child_add ( pid_t pid, int slot, int lst, int cls, struct timeval *start )
+{
+    child_info *nc = NULL;
+    int        *nb = NULL;
+    int        *p  = NULL;
+    int         n  = 0;
+    int         i  = 0;
+
+
+    /*
+     * When the table grows, so does the hash (one chain per entry,
+     * a power of two), and every child is rehashed
+     */
+    if ( nchildren == maxchildren )
+    {
+        n  = ( maxchildren == 0 ? 64 : maxchildren * 2 );
+        nb = malloc ( n * sizeof(int) );
+        nc = ( nb == NULL ? NULL : realloc ( children, n * sizeof(child_info) ) );
+        if ( nc == NULL )
+        {
+            free ( nb );
+            err_msg ( HERE, "unable to allocate memory; not tracking pid %d",
+                      (int) pid );
+            return;
+        }
+        free ( child_buckets );
+        children      = nc;
+        child_buckets = nb;
+        maxchildren   = n;
+
+        for ( i = 0; i < maxchildren; i++ )
+            child_buckets [ i ] = -1;
+        for ( i = 0; i < nchildren; i++ )
+        {
+            p  = &child_buckets [ children [ i ].pid & ( maxchildren - 1 ) ];
+            children [ i ].hnext = *p;
+            *p = i;
+        }
+    }
+
+    p = &child_buckets [ pid & ( maxchildren - 1 ) ];
+    children [ nchildren ].hnext = *p;
+    *p = nchildren;
+
+    children [ nchildren ].pid  = pid;
+    children [ nchildren ].slot = slot;
+    children [ nchildren ].lst  = lst;
+    children [ nchildren ].cls  = cls;
+    children [ nchildren ].released = FALSE;
+    children [ nchildren ].adopted  = ( start != NULL );
+    children [ nchildren ].stage    = 0;
+    children [ nchildren ].bucket   = -1;
+    if ( lst >= 0 )
+        listeners [ lst ].nchildren++;
+    classes [ cls ].active++;
+    if ( start != NULL )
+    {
+        children [ nchildren ].start = *start;
+        nadopted++;
+    }
+    else
+        gettimeofday ( &children [ nchildren ].start, NULL );
+
+    if ( max_session > 0 )
+    {
+        children [ nchildren ].expires =
+            children [ nchildren ].start.tv_sec + max_session;
+        wheel_insert ( nchildren );
+    }
+    nchildren++;
+}
+
+
+/*
+ * Returns the index of 'pid' in the child table, or -1
+ */
+int
+child_find ( pid_t pid )
+{
+    int i = -1;
+
+
+    if ( child_buckets != NULL )
+        for ( i = child_buckets [ pid & ( maxchildren - 1 ) ];
+              i != -1 && children [ i ].pid != pid;
+              i = children [ i ].hnext )
+            ;
+    return i;
+}
+
+
+/*
+ * Returns the link that points to child 'i' in its hash chain
+ */
+int *
+child_chain ( int i )
+{
+    int *p = &child_buckets [ children [ i ].pid & ( maxchildren - 1 ) ];
+
+
+    while ( *p != i )
+        p = &children [ *p ].hnext;
+    return p;
+}
+
+
+/*
+ * Gives back what child 'i' holds: its scoreboard slot and its place
+ * in its listener's and class's budgets.  Done when it is reaped, or
+ * earlier if it had to be killed and may take a while to go away.
+ */
+void
+child_release ( int i )
+{
+    child_info *c = &children [ i ];
+
+
+    if ( c->released )
+        return;
+    c->released = TRUE;
+
+    if ( c->lst >= 0 )
+        listeners [ c->lst ].nchildren--;
+    classes [ c->cls ].active--;
+    sb_release ( c->slot, c->pid );
+}
+
+
+/*
+ * Checks on the children we adopted.  We can't wait() for them, so
+ * each tick we look whether each has given up its scoreboard slot (at
+ * the end of a normal session) or gone away, and if so account for it
+ * as reap_children() would, without its resource usage.
+ */
+void
+adopted_poll ( void )
+{
+    static struct rusage  none;
+    child_info           *c  = NULL;
+    sb_slot_t            *sp = NULL;
+    int                   i  = 0;
+
+
+    for ( i = nchildren - 1; i >= 0; i-- )
+    {
+        c = &children [ i ];
+        if ( !c->adopted )
+            continue;
+
+        sp = SB_SLOT ( sb_hdr, c->slot );
+        if ( sp->s.state != SB_FREE && sp->s.pid == (long) c->pid &&
+             ( kill ( c->pid, 0 ) == 0 || errno != ESRCH ) )
+            continue;
+
+        TRACE ( trace_file, POP_DEBUG, HERE, "adopted session pid %d ended",
+                (int) c->pid );
+        nadopted--;
+        child_release ( i );
+        class_done    ( c->cls, &none, &c->start );
+        arrival_done  ( c->pid, &c->start );
+        child_remove  ( i );
+    }
+}
+
+
+/*
+ * Forgets child 'i', moving the last entry into its place (and fixing
+ * the hash chain and wheel list that entry is on).
+ */
+void
+child_remove ( int i )
+{
+    child_info *c = NULL;
+    int         n = 0;
+
+
+    wheel_unlink ( i );
+    *child_chain ( i ) = children [ i ].hnext;
+
+    n = --nchildren;
+    if ( i == n )
+        return;
+
+    *child_chain ( n ) = i;
+    children [ i ] = children [ n ];
+    c = &children [ i ];
+    if ( c->bucket != -1 )
+    {
+        if ( c->tprev != -1 )
+            children [ c->tprev ].tnext = i;
+        else
+            wheel [ c->bucket ] = i;
+        if ( c->tnext != -1 )
+            children [ c->tnext ].tprev = i;
+    }
+}
+
+
+/*
+ * The session limit enforced by the master: $QPOP_MAX_SESSION seconds
+ * from the fork.  A session over it gets SIGTERM, and SIGKILL
+ * $QPOP_KILL_GRACE seconds (default 10) later if it's still there.
+ * A session stuck in the kernel may not go away even then, so when we
+ * send SIGKILL we give back its scoreboard slot and budgets at once.
+ *
+ * Each child has one pending check time, kept on a hierarchical timer
+ * wheel, so the one-second tick of the main loop only looks at the
+ * children whose check is due.
+ */
+void
+limits_init ( void )
+{
+    int i = 0;
+
+
+    max_session = env_long ( "QPOP_MAX_SESSION", 0 );
+    kill_grace  = env_long ( "QPOP_KILL_GRACE", 10 );
+
+    /*
+     * An idle limit would need Qpopper to report activity, which it
+     * doesn't, so refuse one rather than silently not enforcing it
+     */
+    if ( getenv ( "QPOP_MAX_IDLE" ) != NULL )
+        err_dump ( HERE, "QPOP_MAX_IDLE is not supported (sessions don't "
+                         "report activity); use QPOP_MAX_SESSION" );
+    if ( max_session < 0 || kill_grace < 1 )
+        err_dump ( HERE, "QPOP_MAX_SESSION and QPOP_KILL_GRACE must be positive" );
+
+    for ( i = 0; i < WHEEL_LEVELS * WHEEL_SIZE; i++ )
+        wheel [ i ] = -1;
+    wheel_now = time ( NULL );
+}
+
+
+/*
+ * Puts child 'i' on the wheel for its 'expires' time: on level 0 if
+ * that is within WHEEL_SIZE seconds, otherwise on the level whose
+ * buckets span it.  Times beyond the last level are checked early and
+ * put back.
+ */
+void
+wheel_insert ( int i )
+{
+    child_info *c     = &children [ i ];
+    time_t      t     = c->expires;
+    time_t      delta = 0;
+    int         level = 0;
+    int         b     = 0;
+
+
+    if ( t <= wheel_now )
+        t = wheel_now + 1;
+    delta = t - wheel_now;
+
+    for ( level = 0; level < WHEEL_LEVELS - 1; level++ )
+        if ( delta < ( (time_t) 1 << ( WHEEL_BITS * ( level + 1 ) ) ) )
+            break;
+    if ( level == WHEEL_LEVELS - 1 &&
+         delta >= ( (time_t) 1 << ( WHEEL_BITS * WHEEL_LEVELS ) ) )
+        t = wheel_now + ( (time_t) 1 << ( WHEEL_BITS * WHEEL_LEVELS ) ) - 1;
+
+    b = level * WHEEL_SIZE +
+        (int) ( ( t >> ( WHEEL_BITS * level ) ) & ( WHEEL_SIZE - 1 ) );
+
+    c->bucket = b;
+    c->tprev  = -1;
+    c->tnext  = wheel [ b ];
+    if ( c->tnext != -1 )
+        children [ c->tnext ].tprev = i;
+    wheel [ b ] = i;
+}
+
+
+void
+wheel_unlink ( int i )
+{
+    child_info *c = &children [ i ];
+
+
+    if ( c->bucket == -1 )
+        return;
+
+    if ( c->tprev != -1 )
+        children [ c->tprev ].tnext = c->tnext;
+    else
+        wheel [ c->bucket ] = c->tnext;
+    if ( c->tnext != -1 )
+        children [ c->tnext ].tprev = c->tprev;
+    c->bucket = -1;
+}
+
+
+/*
+ * Runs the wheel forward to 'now', one second at a time.  When level 0
+ * wraps, the next level's current bucket is spread back down, and so
+ * on up.  Children in the level 0 bucket for each second are checked.
+ */
+void
+wheel_advance ( time_t now )
+{
+    int   level = 0;
+    int   b     = 0;
+    int   i     = 0;
+    int   next  = 0;
+
+
+    while ( wheel_now < now )
+    {
+        wheel_now++;
+
+        for ( level = 1; level < WHEEL_LEVELS; level++ )
+        {
+            if ( ( wheel_now & ( ( (time_t) 1 << ( WHEEL_BITS * level ) ) - 1 ) ) != 0 )
+                break;
+
+            b = level * WHEEL_SIZE +
+                (int) ( ( wheel_now >> ( WHEEL_BITS * level ) ) & ( WHEEL_SIZE - 1 ) );
+            for ( i = wheel [ b ], wheel [ b ] = -1; i != -1; i = next )
+            {
+                next = children [ i ].tnext;
+                children [ i ].bucket = -1;
+                wheel_insert ( i );
+            }
+        }
+
+        b = (int) ( wheel_now & ( WHEEL_SIZE - 1 ) );
+        for ( i = wheel [ b ], wheel [ b ] = -1; i != -1; i = next )
+        {
+            next = children [ i ].tnext;
+            children [ i ].bucket = -1;
+            if ( children [ i ].expires <= wheel_now )
+                session_check ( i, wheel_now );
+            else
+                wheel_insert ( i );
+        }
+    }
+}
+
+
+/*
+ * Child 'i''s check time has come: signal it if it is over the limit,
+ * otherwise put it back for when it will be.
+ */
+void
+session_check ( int i, time_t now )
+{
+    child_info *c    = &children [ i ];
+    time_t      life = c->start.tv_sec + max_session;
+
+
+    if ( c->stage == 1 )
+    {
+        msg ( HERE, "session pid %d still there %lds after SIGTERM; "
+                    "sending SIGKILL",
+              (int) c->pid, kill_grace );
+        kill ( c->pid, SIGKILL );
+        c->stage = 2;
+        forced_kills++;
+        if ( sb_hdr != NULL )
+            SB_COUNT ( sb_hdr, forced_kills, 1 );
+        child_release ( i );
+        return;
+    }
+    if ( c->stage == 2 )
+        return;
+
+    if ( now < life )
+    {
+        c->expires = life;
+        wheel_insert ( i );
+        return;
+    }
+
+    msg ( HERE, "session pid %d over its session time limit (%lds); "
+                "sending SIGTERM",
+          (int) c->pid, max_session );
+    kill ( c->pid, SIGTERM );
+    c->stage = 1;
+    limit_kills++;
+    if ( sb_hdr != NULL )
+        SB_COUNT ( sb_hdr, lifetime_kills, 1 );
+
+    c->expires = now + kill_grace;
+    wheel_insert ( i );
+}
+
+
+/*
+ * Logs the session limit counters
+ */
+void
+limits_report ( void )
+{
+    if ( max_session == 0 )
+        return;
+
+    msg ( HERE, "session limits: %lu over session time; %lu needed SIGKILL",
+          limit_kills, forced_kills );
+}
+
+#endif /* STANDALONE */
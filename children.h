@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2001 QUALCOMM Incorporated.  All rights reserved.
+ * The file license.txt specifies the terms for use, modification,
+ * and redistribution.
+ *
+ * The standalone daemon's table of live session children, and the
+ * session time limit ($QPOP_MAX_SESSION) enforced on them from a timer
+ * wheel.  See limits_init().
+ */
+
+#ifndef _CHILDREN_H
+#define _CHILDREN_H
+
+/*
+ * What the master remembers about each session child it forked (or
+ * adopted from a dead acceptor; see sb_adopt()).  Each child is on a
+ * hash chain by pid (see child_find()), and also on a timer wheel list
+ * while session limits apply (see wheel_advance()).
+ */
+typedef struct
+{
+    pid_t           pid;
+    int             hnext;          /* pid hash chain */
+    int             slot;           /* scoreboard slot, or -1 */
+    int             lst;            /* index into listeners */
+    int             cls;            /* index into classes */
+    struct timeval  start;
+    BOOL            released;       /* slot and budgets given back */
+    BOOL            adopted;        /* not ours to wait() for */
+    int             stage;          /* 0; 1 after SIGTERM; 2 after SIGKILL */
+    time_t          expires;        /* next check */
+    int             bucket;         /* wheel list we're on, or -1 */
+    int             tprev;          /* neighbours on it */
+    int             tnext;
+} child_info;
+
+/*
+ * Timer wheel: WHEEL_LEVELS levels of WHEEL_SIZE one-second,
+ * 64-second and 4096-second buckets
+ */
+#define WHEEL_BITS              6
+#define WHEEL_SIZE              ( 1 << WHEEL_BITS )
+#define WHEEL_LEVELS            3
+
+
+extern child_info  *children;
+extern int          nchildren;
+extern int          nadopted;
+extern long         max_session;
+extern time_t       wheel_now;
+
+void    sb_adopt   ( void );
+void    child_add  ( pid_t pid, int slot, int lst, int cls,
+                     struct timeval *start );
+void    adopted_poll  ( void );
+int     child_find ( pid_t pid );
+int    *child_chain ( int i );
+void    child_release ( int i );
+void    child_remove  ( int i );
+void    limits_init   ( void );
+void    wheel_insert  ( int i );
+void    wheel_unlink  ( int i );
+void    wheel_advance ( time_t now );
+void    session_check ( int i, time_t now );
+void    limits_report ( void );
+
+#endif /* _CHILDREN_H */
@@ -2,14 +2,59 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <oslib.h>
 
+#include <winsock.h>
 
+#pragma comment(lib, "wsock32.lib")
+
+/*
+ * How long (milliseconds) the launcher waits for the daemon to say
+ * it's ready.
+ */
+#define READY_TIMEOUT 60000
+
+/*
+ * Port the daemon listens on.
+ */
+#define DAEMON_PORT   8765
+
+
+/*
+ * Starts the daemon process and waits until it signals the (inherited)
+ * ready event, rather than sleeping for a fixed time.  Returns as soon
+ * as the daemon is ready, or with an error if it exits or times out
+ * first.
+ */
 long Daemonize(void)
 {
     PROCESS_INFORMATION procInfo;
     STARTUPINFO         startupInfo;
+    SECURITY_ATTRIBUTES secAttr;
+    HANDLE              hReady;
+    HANDLE              handles[2];
+    DWORD               exitCode;
+    long                result = -1L;
+    char                cmdLine[64];
+
+    secAttr.nLength              = sizeof secAttr;
+    secAttr.lpSecurityDescriptor = NULL;
+    secAttr.bInheritHandle       = TRUE;
+
+    hReady = CreateEvent(&secAttr, TRUE, FALSE, NULL);
+    if (hReady == NULL)
+    {
+        fprintf(stderr, "CreateEvent: %s\n", osError( ));
+        return -1L;
+    }
+
+    /*
+     * The handle goes through "%p", which holds a pointer-sized
+     * HANDLE on Win64 as well as Win32.
+     */
+    sprintf(cmdLine, "daemon -ready %p", (void *) hReady);
 
     startupInfo.cb          = sizeof startupInfo;
     startupInfo.lpReserved  = NULL;
@@ -21,24 +66,95 @@ long Daemonize(void)
 
     printf("Creating daemon process...\n"); fflush(stdout);
 
-    if (!CreateProcess(NULL, "daemon", NULL, NULL, TRUE, 0L,
+    if (!CreateProcess(NULL, cmdLine, NULL, NULL, TRUE, 0L,
 		       NULL, NULL, &startupInfo, &procInfo))
     {
         fprintf(stderr, "CreateProcess: %s\n", osError( ));
+        CloseHandle(hReady);
 	exit(1);
     }
 
-    printf("MAIN: Sleeping for 60 seconds...\n"); fflush(stdout);
-    osSleep(60, 0);
+    printf("MAIN: Waiting for daemon to be ready...\n"); fflush(stdout);
+
+    handles[0] = hReady;
+    handles[1] = procInfo.hProcess;
+
+    switch (WaitForMultipleObjects(2, handles, FALSE, READY_TIMEOUT))
+    {
+    case WAIT_OBJECT_0:
+        printf("MAIN: Daemon is ready\n"); fflush(stdout);
+        result = eOK;
+        break;
+
+    case WAIT_OBJECT_0 + 1:
+        GetExitCodeProcess(procInfo.hProcess, &exitCode);
+        fprintf(stderr, "Daemon exited during start-up (%lu)\n",
+                (unsigned long) exitCode);
+        break;
 
-    return eOK;
+    default:
+        /*
+         * Don't leave a daemon that never came up running behind us
+         */
+        fprintf(stderr, "Daemon not ready after %d seconds\n",
+                READY_TIMEOUT / 1000);
+        TerminateProcess(procInfo.hProcess, 1);
+        break;
+    }
+
+    CloseHandle(procInfo.hThread);
+    CloseHandle(procInfo.hProcess);
+    CloseHandle(hReady);
+
+    return result;
 }
 
 int main(int argc, char *argv[])
 {
-    int ii;
+    int                ii;
+    void              *hReady = NULL;
+    WSADATA            wsaData;
+    SOCKET             sock;
+    struct sockaddr_in addr;
+
+    /*
+     * As the launcher, start the daemon and exit once it's ready.
+     */
+    if (argc < 3 || strcmp(argv[1], "-ready") != 0)
+        exit(Daemonize( ) == eOK ? 0 : 1);
+
+    /*
+     * As the daemon, get the listening socket set up first; if that
+     * fails we just exit, and the launcher sees us go.
+     */
+    if (WSAStartup(MAKEWORD(1, 1), &wsaData) != 0)
+    {
+        fprintf(stderr, "WSAStartup failed\n");
+        exit(1);
+    }
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port        = htons(DAEMON_PORT);
+    if (sock == INVALID_SOCKET ||
+        bind(sock, (struct sockaddr *) &addr, sizeof addr) == SOCKET_ERROR ||
+        listen(sock, 5) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "Unable to listen on port %d (error %d)\n",
+                DAEMON_PORT, WSAGetLastError( ));
+        exit(1);
+    }
 
-    Daemonize( );
+    /*
+     * Only now tell the launcher we're up.
+     */
+    if (sscanf(argv[2], "%p", &hReady) == 1)
+    {
+        SetEvent((HANDLE) hReady);
+        CloseHandle((HANDLE) hReady);
+    }
 
     for (ii = 0; ii < 100; ii++)
     {
@@ -46,5 +162,7 @@ int main(int argc, char *argv[])
         osSleep(1, 0);
     }
 
+    closesocket(sock);
+    WSACleanup( );
     exit(0);
 }
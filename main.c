@@ -5,6 +5,111 @@
  *
  * Revisions:
  *
+ *     10/19/26  [agent]
+ *              - The access rules, session children and limits, PROXY
+ *                protocol, reverse DNS, scheduling classes and
+ *                acceptor supervisor are now in their own files
+ *                (acl.c, children.c, proxy.c, rdns.c, sched_class.c,
+ *                supervisor.c); standalone.h has what they share.
+ *
+ *     10/19/26  [agent]
+ *              - With $QPOP_SUPERVISE set, a small supervisor process
+ *                holds the listening sockets and forks the acceptors,
+ *                restarting any that dies (backing off if one keeps
+ *                dying).  A restarted acceptor adopts the sessions its
+ *                predecessor left running, from the scoreboard.
+ *                Restarts are counted in the scoreboard.
+ *
+ *     10/19/26  [agent]
+ *              - The master enforces $QPOP_MAX_SESSION (seconds):
+ *                SIGTERM, then SIGKILL after $QPOP_KILL_GRACE.
+ *                Deadlines are kept on a timer wheel; kills are counted
+ *                in the scoreboard and logged on HUP.  $QPOP_MAX_IDLE
+ *                is refused, as sessions don't report activity.
+ *
+ *     10/19/26  [agent]
+ *              - Optional PROXY protocol v1/v2 per listener ("/proxy=1"),
+ *                read by the master without blocking and with a
+ *                timeout; the real client address is used for access
+ *                rules, the scoreboard and the arrival log, and set as
+ *                $QPOP_PEERADDR/$QPOP_PEERPORT for the session (which
+ *                Qpopper doesn't read yet).
+ *
+ *     10/19/26  [agent]
+ *              - err_msg() collapses repeats of the same error (same
+ *                place and errno) within $QPOP_ERR_WINDOW seconds into
+ *                one "repeated N times" line, and writes at most 20
+ *                error lines a second; suppressed messages are counted
+ *                in the scoreboard and logged on HUP.
+ *
+ *     10/19/26  [agent]
+ *              - accept() failing with EMFILE/ENFILE no longer spins:
+ *                a reserve descriptor is given up to turn the pending
+ *                client away, and accept() backs off as after a fork()
+ *                failure.  Counted in the scoreboard.
+ *
+ *     10/19/26  [agent]
+ *              - Scheduling classes for session children ($QPOP_CLASSES:
+ *                nice, I/O priority, SCHED_BATCH), chosen per listener
+ *                or per access rule; per-class session, CPU and
+ *                elapsed-time counters are logged on HUP.
+ *
+ *     10/19/26  [agent]
+ *              - Several listeners, IPv4 and IPv6, in one event loop:
+ *                groups of arguments separated by "+", each an address
+ *                (with optional backlog and session limit) and its own
+ *                Qpopper arguments.  Accept is round-robin across
+ *                ready listeners; counters are logged on HUP.
+ *
+ *     10/19/26  [agent]
+ *              - Optional asynchronous reverse DNS with an LRU cache
+ *                ($QPOP_RDNS_CACHE); a miss waits at most
+ *                $QPOP_RDNS_WAIT ms for the answer, and known names
+ *                are set as $QPOP_PEERNAME in the child (which Qpopper
+ *                doesn't read yet).
+ *
+ *     10/19/26  [agent]
+ *              - Optional multiple acceptor processes on SO_REUSEPORT
+ *                sockets ($QPOP_ACCEPTORS), with BPF steering by client
+ *                address or CPU ($QPOP_STEER, with $QPOP_SUPERVISE).
+ *
+ *     10/19/26  [agent]
+ *              - Address:port parsing and the hand-off of the client
+ *                socket moved into functions (parse_listen_addr(),
+ *                hand_off_socket()) so popbench can time them.  A lone
+ *                address now keeps the default port, and over-long or
+ *                malformed arguments are rejected.
+ *
+ *     10/19/26  [agent]
+ *              - Optional connection arrival log ($QPOP_ARRIVALS) for
+ *                replay with popreplay.
+ *              - Children are now reaped from the main loop on all
+ *                platforms, and tracked in a child table.
+ *
+ *     10/19/26  [agent]
+ *              - Optional client allow/deny prefix lists ($QPOP_ACCESS),
+ *                checked before forking; reloaded on HUP.
+ *
+ *     10/19/26  [agent]
+ *              - The launching process now waits until the daemon is
+ *                listening and exits with its status; also sends
+ *                sd_notify-style READY=1 to $NOTIFY_SOCKET.
+ *
+ *     10/19/26  [agent]
+ *              - fork() failure no longer aborts the daemon: the client
+ *                gets "-ERR [SYS/TEMP] server busy" and accept() is
+ *                paused with exponential backoff until a fork succeeds.
+ *
+ *     10/19/26  [agent]
+ *              - Per-connection TCP socket policy (buffer sizes,
+ *                TCP_NODELAY, TCP_NOTSENT_LOWAT, keepalive,
+ *                TCP_USER_TIMEOUT) from QPOP_* environment variables.
+ *
+ *     10/19/26  [agent]
+ *              - Optional shared-memory scoreboard (QPOP_SCOREBOARD),
+ *                one slot per session child (pid, client, age); see
+ *                scoreboard.h and popstat.c.
+ *
  *     04/03/01  [rcg]
  *              - Be a little nicer with "-v".
  *
@@ -64,9 +169,16 @@
 #include <sys/types.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <sys/wait.h>
 #include <sys/errno.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifdef __linux__
+#  include <linux/filter.h>
+#  include <sys/prctl.h>
+#  include <sys/syscall.h>
+#endif /* __linux__ */
 #include <arpa/inet.h>
 #include <stdarg.h>
 #include <signal.h>
@@ -75,12 +187,24 @@
 #include <limits.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include <netdb.h>
 #include <sys/socket.h> /* this needs to be after other .h files */
 
 #include "config.h"
 #include "popper.h"
 #include "snprintf.h"
 #include "logit.h"
+#include "scoreboard.h"
+#include "standalone.h"
+#include "acl.h"
+#include "children.h"
+#include "proxy.h"
+#include "rdns.h"
+#include "sched_class.h"
+#include "supervisor.h"
 
 #if HAVE_UNISTD_H
 #  include <unistd.h>
@@ -138,34 +262,93 @@ char *argv[];
 
 #define BAD_ADDR ( (unsigned long) -1 )
 
+
 /*
- * Be careful using TRACE in an 'if' statement!
+ * TCP options applied to each accepted connection before it is handed
+ * to Qpopper.  A value of -1 leaves the kernel default alone.
  */
-#define TRACE if ( debug ) logit
+typedef struct
+{
+    int     sndbuf;                 /* SO_SNDBUF, bytes */
+    int     rcvbuf;                 /* SO_RCVBUF, bytes */
+    int     nodelay;                /* TCP_NODELAY, 0 or 1 */
+    int     notsent_lowat;          /* TCP_NOTSENT_LOWAT, bytes */
+    int     keepalive;              /* SO_KEEPALIVE, 0 or 1 */
+    int     keepidle;               /* TCP_KEEPIDLE, seconds */
+    int     keepintvl;              /* TCP_KEEPINTVL, seconds */
+    int     keepcnt;                /* TCP_KEEPCNT, probes */
+    int     user_timeout;           /* TCP_USER_TIMEOUT, milliseconds */
+} sock_policy;
 
 
 /*
- * System prototypes (functions often missing prototypes in
- * system header files)
+ * Repeated errors (see errlog_suppress()).  Messages from the same
+ * place with the same errno within the window are logged once, and at
+ * most ERRLOG_RATE error lines a second are written in all.
  */
-void bzero();
-pid_t wait3();
+#define ERRLOG_SLOTS           32
+#define ERRLOG_WINDOW          10   /* seconds */
+#define ERRLOG_RATE            20   /* lines per second */
+
+typedef struct
+{
+    const char     *fn;             /* call site, or NULL if unused */
+    int             ln;
+    int             err;
+    time_t          since;          /* start of window */
+    unsigned long   repeats;        /* suppressed in this window */
+} errlog_entry;
 
 
 /*
  * Local prototypes
  */
 int     main ( int argc, char *argv[] );
-void    msg      ( WHENCE, const char *format, ... );
-void    err_msg  ( WHENCE, const char *format, ... );
-void    err_dump ( WHENCE, const char *format, ... );
 void    my_perror   ( void );
 char   *sys_err_str ( void );
-int     reaper  ( SIGPARAM );
-int     hupit   ( SIGPARAM );
-int     cleanup ( SIGPARAM );
-void    roll_it ( void );
-void    motherforker ( int newsockfd, int sockfd );
+BOOL    errlog_suppress ( const char *fn, int ln, int err );
+void    errlog_close    ( errlog_entry *e );
+void    errlog_flush    ( BOOL all );
+void    reap_children ( void );
+pid_t   motherforker ( int newsockfd, listener *l, int cls,
+                       struct sockaddr *cli_addr, char *peername );
+void    accept_one   ( listener *l );
+int     parse_listen_addr ( const char *spec, unsigned long *addr,
+                            unsigned short *port );
+int     parse_listen_spec ( const char *spec, listener *l );
+void    parse_listeners   ( int argc, char *argv[] );
+void    hand_off_socket   ( int newsockfd );
+int     open_listener     ( listener *l, BOOL reuseport );
+void    listener_report   ( void );
+void    get_sock_policy   ( sock_policy *pol );
+void    apply_sock_policy ( int fd, sock_policy *pol, BOOL listener );
+void    overload_begin ( int newsockfd, const char *why );
+void    busy_reply     ( int newsockfd );
+void    fd_exhausted   ( listener *l );
+void    overload_end   ( void );
+struct timeval *overload_pause ( struct timeval *tv );
+void    wait_ready   ( int fd );
+void    notify_ready ( int status, const char *text );
+void    sb_open    ( const char *path, int nslots );
+int     sb_claim   ( void );
+void    arrival_accept ( struct sockaddr *sa, pid_t pid, struct timeval *when );
+void    arrival_write  ( const char *line, int len );
+
+
+/*
+ * Backoff after fork() failures, in milliseconds.  Each consecutive
+ * failure doubles the pause, up to the maximum.
+ */
+#define OVERLOAD_MIN_DELAY     50
+#define OVERLOAD_MAX_DELAY   5000
+
+#define OVERLOAD_BUSY_RESP   "-ERR [SYS/TEMP] server busy\r\n"
+
+/*
+ * How long (seconds) the launching process waits to hear that the
+ * daemon is listening.
+ */
+#define READY_TIMEOUT          60
 
 
 /*
@@ -174,6 +357,7 @@ void    motherforker ( int newsockfd, int sockfd );
 char           *pname       = NULL;
 volatile BOOL   bClean      = FALSE;
 volatile BOOL   bRollover   = FALSE;
+volatile BOOL   bReap       = FALSE;
 char          **Qargv       = NULL;
 int             Qargc       = 0;
 BOOL            Qargv_alloc = FALSE;
@@ -183,28 +367,57 @@ char           *trace_name  = NULL;
 char            msg_buf [ 2048 ] = "";
 FILE           *msg_out     = NULL;
 FILE           *err_out     = NULL;
+sb_hdr_t       *sb_hdr      = NULL;
+sb_slot_t      *sb_me       = NULL;     /* our slot, in a session child */
+int             sb_nslots   = 0;
+int             sb_hint     = 0;
+sock_policy     sock_pol;
+long            overload_delay  = 0;    /* current backoff (ms); 0 if none */
+struct timeval  overload_until;         /* don't accept before this */
+unsigned long   fork_failures   = 0;
+unsigned long   overload_pauses = 0;
+unsigned long   fd_exhaustions  = 0;
+errlog_entry    errlog        [ ERRLOG_SLOTS ];
+long            errlog_window   = ERRLOG_WINDOW;
+int             errlog_pending  = 0;    /* summaries not yet logged */
+time_t          errlog_sec      = 0;    /* second errlog_lines is for */
+int             errlog_lines    = 0;
+unsigned long   errlog_dropped  = 0;    /* over the rate, not yet reported */
+unsigned long   errors_suppressed = 0;
+int             reserve_fd      = -1;   /* given up when out of fds */
+int             ready_fd        = -1;   /* pipe back to the launcher */
+int             arrival_fd      = -1;   /* connection arrival log */
+int             nacceptors      = 1;    /* acceptor processes */
+int             acceptor_id     = 0;    /* which one we are */
+listener        listeners     [ MAX_LISTENERS ];
+int             nlisteners      = 0;
+int             next_listener   = 0;    /* where the next accept pass starts */
+unsigned long   accept_count    = 0;
 
 
 /*
  * In standalone mode, main() is the daemon function.  The port number
- * can be specified as argv[1], e.g., 'popper 110'.
+ * can be specified as argv[1], e.g., 'popper 110'.  More listeners,
+ * each with its own Qpopper arguments, follow a "+" argument, e.g.,
+ *
+ *     popper 110 -S + [::]:110 -S + 10.0.0.1:1110/max=20 -T600
+ *
+ * (see parse_listeners()).  A lone "+" always separates listeners; it
+ * can't be passed through to Qpopper.
  */
 int
 main ( int argc, char *argv[] )
 {
-    int                 sockfd      = -1;
-    int                 newsockfd   = -1;
-    int                 clilen      =  0;
     int                 i           =  0;
+    int                 j           =  0;
     int                 rslt        =  0;
-    struct sockaddr_in  cli_addr;
-    struct sockaddr_in  serv_addr;
+    listener           *l           = NULL;
     char               *ptr         = NULL;
-    unsigned short      port        = SERV_TCP_PORT;
-    unsigned long       addr        = INADDR_ANY;
-    fd_set              fdset_templ;
     fd_set              fdset_read;
-    int                 fd_flags    = 0;
+    int                 maxfd       = -1;
+    struct timeval      pause_tv;
+    struct timeval      proxy_tv;
+    struct timeval     *pause_tvp   = NULL;
 
 
     if ( argc >= 2 && ( strncmp ( argv[1], "-v",  2 ) == 0 ||
@@ -220,18 +433,6 @@ main ( int argc, char *argv[] )
 
     err_out = msg_out  = fopen ( "/dev/null", "w+" ); /* until we get set up */
 
-    /*
-     * Ensure default port & address is in network order
-     */
-    addr = htonl ( addr );
-    port = htons ( port );
-
-    /*
-     * Set defaults for Qargc and Qargv
-     */
-    Qargc = argc;
-    Qargv = argv;
-
     /*
      * Get our own name (if provided)
      */
@@ -244,67 +445,12 @@ main ( int argc, char *argv[] )
     }
 
     /*
-     * The first specified parameter may be an IP address
-     * and/or a port number.  If so, this is what we bind
-     * to.  Otherwise we use defaults.
+     * Work out what we listen on, and the arguments Qpopper gets for
+     * each listener.  Qargc and Qargv are the first listener's.
+     * Listeners can name scheduling classes, so read those first.
      */
-    ptr = argv [ 1 ];
-    if ( argc >= 2 && ( *ptr == ':' || isdigit ( (int) *ptr ) ) )
-    {
-        unsigned long  a = addr;
-        unsigned short n = port;
-        char           b [ 25 ] = "";
-        char          *q = b;
-
-        /*
-         * We might have an ip address first
-         */
-        if ( strchr ( ptr, '.' ) != NULL )
-            while ( *ptr == '.' || isdigit ( (int) *ptr ) )
-                *q++ = *ptr++;
-        
-        if ( *b != '\0' )
-        {
-            a   = inet_addr ( b );
-            ptr = strchr ( ptr, ':' );
-            if ( ptr != NULL )
-                ptr++;
-        }
-        else
-        {
-            ptr = argv [ 1 ];
-            if ( *ptr == ':' )
-                ptr++;
-        }
-
-        /*
-         * We might have a port number
-         */
-        if ( ptr != NULL )
-            n = atoi ( ptr );
-
-        if ( a == BAD_ADDR || n == 0 || n > USHRT_MAX )
-            err_dump ( HERE, "invalid address and/or port: \"%s\"", argv[1] );
-
-        port = htons ( n );
-        addr = a;
-        
-        /*
-         * Since we consumed the first specified parameter,
-         * create our own argv that omits it, to pass on to
-         * Qpopper.
-         */
-        rslt  = sizeof(char *) * argc;
-        Qargv = malloc ( rslt );
-        if ( Qargv == NULL )
-            err_dump ( HERE, "unable to allocate memory" );
-        Qargv_alloc = TRUE;
-        bzero ( Qargv, rslt );
-        Qargv [ 0 ] = argv [ 0 ];
-        for ( rslt = 2; rslt < argc; rslt++ )
-            Qargv [ rslt - 1 ] = argv [ rslt ];
-        Qargc = argc - 1;
-    }
+    class_load();
+    parse_listeners ( argc, argv );
 
     /*
      * Open the log
@@ -316,33 +462,40 @@ main ( int argc, char *argv[] )
 #endif
 
     /*
-     * See if debug or trace options specified
+     * See if debug or trace options specified, for any listener
      */
-    i = getopt ( Qargc, Qargv, "b:BcCdD:e:f:FkK:l:L:p:RsSt:T:uUvy:" );
-    while ( i != EOF )
+    for ( j = 0; j < nlisteners; j++ )
     {
-        switch ( i )
+        l = &listeners [ j ];
+        optind = 1;
+        i = getopt ( l->argc, l->argv, "b:BcCdD:e:f:FkK:l:L:p:RsSt:T:uUvy:" );
+        while ( i != EOF )
         {
-            case 'd':
-                debug = TRUE;
-                break;
-
-            case 't':
-                debug = TRUE;
-                trace_name = strdup ( optarg );
-                trace_file = fopen ( optarg, "a" );
-                if ( trace_file == NULL )
-                    err_dump ( HERE, "Unable to open trace file \"%s\"", optarg );
-                TRACE ( trace_file, POP_DEBUG, HERE,
-                        "Opened trace file \"%s\" as %d",
-                        trace_name, fileno(trace_file) );
-                break;
+            switch ( i )
+            {
+                case 'd':
+                    debug = TRUE;
+                    break;
+
+                case 't':
+                    debug = TRUE;
+                    if ( trace_file != NULL )
+                        break;  /* one trace file for the daemon */
+                    trace_name = strdup ( optarg );
+                    trace_file = fopen ( optarg, "a" );
+                    if ( trace_file == NULL )
+                        err_dump ( HERE, "Unable to open trace file \"%s\"", optarg );
+                    TRACE ( trace_file, POP_DEBUG, HERE,
+                            "Opened trace file \"%s\" as %d",
+                            trace_name, fileno(trace_file) );
+                    break;
+
+                default:
+                    break;
+            }
 
-            default:
-                break;
+            i = getopt ( l->argc, l->argv, "b:BcCdD:e:f:FkK:l:L:p:RsSt:T:uUvy:" );
         }
-
-        i = getopt ( Qargc, Qargv, "b:BcCdD:e:f:FkK:l:L:p:RsSt:T:uUvy:" );
     }
     optind = 1; /* reset for pop_init */
 
@@ -365,20 +518,35 @@ main ( int argc, char *argv[] )
      * required so that the new process is guaranteed not to be a
      * process group leader. The next step, `setsid()', fails if we're
      * a process group leader.
+     *
+     * The parent doesn't go away until the daemon tells it, over
+     * a pipe, that it is listening (or why it couldn't), so whoever
+     * started us gets a meaningful exit status.
      */
-    rslt = fork();
-    if ( rslt == -1 )
-        err_dump ( HERE, "fork() failed" );
-    if ( rslt > 0 )
     {
+        int ready_pipe [ 2 ];
+
+
+        if ( pipe ( ready_pipe ) == -1 )
+            err_dump ( HERE, "pipe() failed" );
+
+        rslt = fork();
+        if ( rslt == -1 )
+            err_dump ( HERE, "fork() failed" );
+        if ( rslt > 0 )
+        {
+            TRACE ( trace_file, POP_DEBUG, HERE, 
+                    "%s: Server: first fork(); child=%i; waiting for ready",
+                    pname, rslt );
+            close ( ready_pipe [ 1 ] );
+            wait_ready ( ready_pipe [ 0 ] ); /* exits */
+        }
         TRACE ( trace_file, POP_DEBUG, HERE, 
-                "%s: Server: first fork(); child=%i; exiting",
-                pname, rslt );
-         exit ( 0 ); /* if we're the parent we just go away */
+                "%s: Server: child of first fork(); pid=%i",
+                pname, getpid() );
+        close ( ready_pipe [ 0 ] );
+        ready_fd = ready_pipe [ 1 ];
     }
-    TRACE ( trace_file, POP_DEBUG, HERE, 
-            "%s: Server: child of first fork(); pid=%i",
-            pname, getpid() );
 
     /*
      * Next call `setsid()' to become a process group and session
@@ -444,6 +612,8 @@ main ( int argc, char *argv[] )
     TRACE ( trace_file, POP_DEBUG, HERE, "closing file descs %d to 0", sysconf ( _SC_OPEN_MAX )  );
     for ( i = sysconf ( _SC_OPEN_MAX ); i >= 0; i-- )
     {
+        if ( i == ready_fd )
+            continue;
         if ( debug == FALSE || trace_file == NULL || i != fileno(trace_file) )
             close ( i );
     }
@@ -473,91 +643,102 @@ main ( int argc, char *argv[] )
 #endif /* not _DEBUG */
 
     /*
-     * Set up the socket on which we listen
+     * Map the scoreboard, if one was asked for
      */
-    sockfd = socket ( AF_INET, SOCK_STREAM, 0 );
-    if ( sockfd < 0 )
-        err_dump ( HERE, "Can't open stream socket" );
-    TRACE ( trace_file, POP_DEBUG, HERE, "opened stream socket; sockfd = %d", sockfd );
- 
-    i = 1;
-    rslt = setsockopt ( sockfd, SOL_SOCKET, SO_REUSEADDR, 
-                        (char *) &i, sizeof(i) );
-    if ( rslt == -1 )
-        err_dump ( HERE, "setsockopt(SO_REUSEADDR) failed" );
+    ptr = getenv ( "QPOP_SCOREBOARD" );
+    if ( ptr != NULL && *ptr != '\0' )
+        sb_open ( ptr, (int) env_long ( "QPOP_SCOREBOARD_SLOTS",
+                                        SB_DEFAULT_SLOTS ) );
 
-    if ( debug )
+    /*
+     * Start the arrival log, if one was asked for
+     */
+    arrival_open();
+
+    /*
+     * Load client access rules, if any.  Without them we can't do
+     * what we were asked, so don't start.
+     */
+    ptr = getenv ( "QPOP_ACCESS" );
+    if ( ptr != NULL && *ptr != '\0' )
     {
-        rslt = setsockopt ( sockfd, SOL_SOCKET, SO_DEBUG,
-                            (char *) &i, sizeof(i) );
-        if ( rslt == -1 )
-            TRACE ( trace_file, POP_DEBUG, HERE, 
-                    "%s: Server: setsockopt(SO_DEBUG) failed", pname );
+        acl_reload();
+        if ( acl == NULL )
+            err_dump ( HERE, "Unable to load access rules from \"%s\"", ptr );
     }
 
-    TRACE ( trace_file, POP_DEBUG, HERE, "set stream socket options; sockfd = %d", sockfd );
-
-    bzero ( (char *) &serv_addr, sizeof(serv_addr) );
-    serv_addr.sin_family      = AF_INET;
-    serv_addr.sin_addr.s_addr = addr;
-    serv_addr.sin_port        = port;
-
-    rslt = bind ( sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr) );
-    if ( rslt < 0 )
+    /*
+     * Set up the socket(s) on which we listen.  With several acceptor
+     * processes each gets its own socket for each listener, in an
+     * SO_REUSEPORT group, and the kernel (optionally steered by a BPF
+     * program) spreads connections across them.
+     */
+    get_sock_policy ( &sock_pol );
+    errlog_window = env_long ( "QPOP_ERR_WINDOW", ERRLOG_WINDOW );
+    proxy_timeout = env_long ( "QPOP_PROXY_TIMEOUT", PROXY_TIMEOUT );
+    limits_init();
+
+    nacceptors = (int) env_long ( "QPOP_ACCEPTORS", 1 );
+    if ( nacceptors < 1 || nacceptors > MAX_ACCEPTORS )
+        err_dump ( HERE, "QPOP_ACCEPTORS must be 1 to %d", MAX_ACCEPTORS );
+    if ( sb_hdr != NULL )
+        sb_hdr->h.nacceptors = nacceptors;
+
+    for ( j = 0; j < nlisteners; j++ )
     {
-        if ( errno == EADDRINUSE )
+        l = &listeners [ j ];
+        for ( i = 0; i < nacceptors; i++ )
         {
-            fprintf ( stderr, "%s:%d in use\n",
-                      inet_ntoa ( serv_addr.sin_addr ),
-                      ntohs     ( serv_addr.sin_port ) );
-            return 1;
+            l->fds [ i ] = open_listener ( l, nacceptors > 1 );
+            if ( l->fds [ i ] == -1 )
+                return 1;
         }
-        else
-            err_dump ( HERE, "Can't bind local address %s:%d",
-                       inet_ntoa ( serv_addr.sin_addr ),
-                       ntohs     ( serv_addr.sin_port ) );
-    }
-
-    TRACE ( trace_file, POP_DEBUG, HERE,
-            "did bind on stream socket; sockfd = %d",
-            sockfd );
 
+        if ( nacceptors > 1 )
+            steer_acceptors ( l->fds [ 0 ], l->addr.ss_family, nacceptors );
+    }
 
     /*
      * Now we're ready to go
      */
-    msg ( HERE, "listening on %s:%d\n",
-          inet_ntoa ( serv_addr.sin_addr ),
-          ntohs     ( serv_addr.sin_port ) );
-
-    TRACE ( trace_file, POP_DEBUG, HERE, "listening using socket fd %d", sockfd );
+    for ( j = 0; j < nlisteners; j++ )
+    {
+        l = &listeners [ j ];
+        if ( l->max_children > 0 )
+            msg ( HERE, "listening on %s (backlog %d; at most %d sessions)",
+                  l->name, l->backlog, l->max_children );
+        else
+            msg ( HERE, "listening on %s", l->name );
+    }
 
-    listen ( sockfd, 5 );
+    /*
+     * Let our launcher (and any supervisor) know we're up
+     */
+    notify_ready ( 0, NULL );
 
     /*
-     * Set file descriptor to be non-blocking in case there isn't really a
-     * connection available if the select succeeds.  This avoids us
-     * blocking there.
+     * Start the other acceptors; from here on each process (this one
+     * is acceptor 0) serves its own sockets.
      */
-    fd_flags = fcntl ( sockfd, F_GETFL, 0 );
-    rslt     = fcntl ( sockfd, F_SETFL, O_NONBLOCK | fd_flags );
-    if ( rslt == -1 )
-        err_dump ( HERE, "Unable to set sockfd(%d) to be non-blocking",
-                   sockfd );
-    TRACE ( trace_file, POP_DEBUG, HERE, "set fd %d non-blocking (%#x)",
-            sockfd, fcntl ( sockfd, F_GETFL, 0 ) );
+    start_acceptors();
+    TRACE ( trace_file, POP_DEBUG, HERE, "acceptor %d serving %d listener(s)",
+            acceptor_id, nlisteners );
+
+    rdns_init();
 
     /*
-     * Build the template descriptor set
+     * Hold a descriptor in reserve, for turning away a connection when
+     * we run out (see fd_exhausted())
      */
-    memset ( &fdset_templ, 0, sizeof(fdset_templ) );
-    FD_SET ( sockfd, &fdset_templ );
+    reserve_fd = open ( "/dev/null", O_RDONLY );
+    if ( reserve_fd == -1 )
+        err_msg ( HERE, "Unable to open reserve descriptor" );
 
-#ifdef    BSD
+    /*
+     * Children are reaped from the main loop (see reaper()), so this
+     * works with both BSD and System V signal semantics.
+     */
     signal ( SIGCHLD, VOIDSTAR reaper  );
-#else /* not BSD */
-    signal ( SIGCHLD, SIG_IGN          ); /* ignore them and they'll go away */
-#endif /* BSD */
 
     signal ( SIGHUP,  VOIDSTAR hupit   );
     signal ( SIGTERM, VOIDSTAR cleanup );
@@ -567,8 +748,9 @@ main ( int argc, char *argv[] )
         if ( bClean )
         {
             msg   ( HERE, "cleaning up and exiting normally" );
-            close ( sockfd );
-            sockfd = -1;
+            errlog_flush ( TRUE );
+            signal_acceptors ( SIGTERM );
+            close_listeners();
             if ( trace_file != NULL )
             {
                 fclose ( trace_file );
@@ -577,46 +759,147 @@ main ( int argc, char *argv[] )
             exit  ( 0 );
         }
 
+        if ( bReap )
+            reap_children();
+
+        if ( nadopted > 0 )
+            adopted_poll();
+
+        if ( max_session > 0 )
+            wheel_advance ( time ( NULL ) );
+
         if ( bRollover )
         {
+            signal_acceptors ( SIGHUP );
             roll_it();
+            arrival_open();
+            acl_reload();
+            msg ( HERE, "acceptor %d: %lu connections accepted",
+                  acceptor_id, accept_count );
+            listener_report();
+            class_report();
+            limits_report();
+            proxy_report();
+            errlog_flush ( TRUE );
+            msg ( HERE, "%lu repeated error messages suppressed",
+                  errors_suppressed );
+            rdns_report();
             bRollover = FALSE;
             signal ( SIGHUP,  VOIDSTAR hupit   );
         }
 
         /*
-         * Copy the template descriptor set into our read set (since
-         * select() modifies the fd set we pass in).
+         * While shedding load after a fork() failure we don't accept;
+         * new connections wait in the listen queues until the pause
+         * is over.  Likewise for a listener that has as many sessions
+         * as it is allowed.
+         */
+        pause_tvp = overload_pause ( &pause_tv );
+
+        FD_ZERO ( &fdset_read );
+        maxfd = -1;
+        for ( j = 0; j < nlisteners && pause_tvp == NULL; j++ )
+        {
+            l = &listeners [ j ];
+            if ( l->fd == -1 )
+                continue;
+
+            if ( l->max_children > 0 && l->nchildren >= l->max_children )
+            {
+                if ( l->full == FALSE )
+                {
+                    l->full = TRUE;
+                    l->full_count++;
+                    TRACE ( trace_file, POP_DEBUG, HERE,
+                            "%s has %d sessions; not accepting",
+                            l->name, l->nchildren );
+                }
+                continue;
+            }
+            l->full = FALSE;
+
+            FD_SET ( l->fd, &fdset_read );
+            if ( l->fd > maxfd )
+                maxfd = l->fd;
+        }
+
+        if ( rdns_fd != -1 )
+        {
+            FD_SET ( rdns_fd, &fdset_read );
+            if ( rdns_fd > maxfd )
+                maxfd = rdns_fd;
+        }
+
+        for ( j = 0; j < nproxy; j++ )
+        {
+            FD_SET ( proxy_conns [ j ].fd, &fdset_read );
+            if ( proxy_conns [ j ].fd > maxfd )
+                maxfd = proxy_conns [ j ].fd;
+        }
+
+        errlog_flush ( FALSE );
+
+        if ( pause_tvp == NULL && ( nchildren > 0 || errlog_pending > 0 ) )
+        {
+            /*
+             * Wake up now and then in case a SIGCHLD slipped in
+             * between our check of bReap and select(), and to log
+             * error repeat counts when their window closes.
+             */
+            pause_tv.tv_sec  = 1;
+            pause_tv.tv_usec = 0;
+            pause_tvp        = &pause_tv;
+        }
+
+        /*
+         * Wake up in time to drop connections whose PROXY header is
+         * overdue
          */
-        fdset_read = fdset_templ;
+        if ( proxy_wait ( &proxy_tv ) != NULL &&
+             ( pause_tvp == NULL || timercmp ( &proxy_tv, pause_tvp, < ) ) )
+        {
+            pause_tv  = proxy_tv;
+            pause_tvp = &pause_tv;
+        }
 
         /*
          * Check for a new connection with select() before calling accept(),
          * since accept() does not return on signals on some platforms.
          */
-        rslt = select ( sockfd + 1, &fdset_read, NULL, NULL, NULL );
+        rslt = select ( maxfd + 1, &fdset_read, NULL, NULL, pause_tvp );
         if ( rslt == -1 && errno != EINTR )
             err_dump ( HERE, "select() error" );
 
-        if ( rslt == 0 || ( FD_ISSET(sockfd, &fdset_read) == FALSE ) )
-            err_dump ( HERE, "unexpected select() result" ); 
+        if ( nproxy > 0 )
+        {
+            if ( rslt == -1 )
+                FD_ZERO ( &fdset_read );
+            proxy_poll ( &fdset_read );
+        }
 
-        clilen    = sizeof(cli_addr);
-        newsockfd = accept ( sockfd, (struct sockaddr *) &cli_addr, &clilen );
+        if ( rslt == -1 || ( rslt == 0 && pause_tvp != NULL ) )
+            continue; /* interrupted, pause over, or timed out */
 
-        TRACE ( trace_file, POP_DEBUG, HERE, 
-                "accept=%d; sockfd=%d; clilen=%d; cli_addr=%s:%d\n",
-                newsockfd, sockfd, clilen, 
-                inet_ntoa ( cli_addr.sin_addr ),
-                ntohs     ( cli_addr.sin_port ) );
+        if ( rslt == 0 )
+            err_dump ( HERE, "unexpected select() result" ); 
 
-        if ( newsockfd > 0 )
-            motherforker ( newsockfd, sockfd ); 
-        else
-            if ( errno != EINTR && errno != EWOULDBLOCK 
-                                && errno != EPROTO
-                                && errno != ECONNABORTED )
-                err_msg ( HERE, "accept() error" );
+        if ( rdns_fd != -1 && FD_ISSET(rdns_fd, &fdset_read) )
+            rdns_reply();
+
+        /*
+         * Take at most one connection from each ready listener, starting
+         * with a different one each pass, so a busy listener can't keep
+         * the others waiting.
+         */
+        for ( j = 0; j < nlisteners; j++ )
+        {
+            l = &listeners [ ( next_listener + j ) % nlisteners ];
+            if ( l->fd != -1 && FD_ISSET(l->fd, &fdset_read) )
+                accept_one ( l );
+            if ( overload_pause ( &pause_tv ) != NULL )
+                break;
+        }
+        next_listener = ( next_listener + 1 ) % nlisteners;
 
     } /* main loop */
 
@@ -624,6 +907,94 @@ main ( int argc, char *argv[] )
 }
 
 
+/*
+ * Accepts a connection on 'l'.  Unless we must first read a PROXY
+ * header, hands it to admit().
+ */
+void
+accept_one ( listener *l )
+{
+    struct sockaddr_storage cli_addr;
+    socklen_t               clilen    = sizeof(cli_addr);
+    int                     newsockfd = -1;
+    char                    client [ 64 ];
+
+
+    newsockfd = accept ( l->fd, (struct sockaddr *) &cli_addr, &clilen );
+    if ( newsockfd < 0 )
+    {
+        if ( errno == EMFILE || errno == ENFILE )
+            fd_exhausted ( l );
+        else
+        if ( errno != EINTR && errno != EWOULDBLOCK 
+                            && errno != EPROTO
+                            && errno != ECONNABORTED )
+            err_msg ( HERE, "accept() error on %s", l->name );
+        return;
+    }
+
+    TRACE ( trace_file, POP_DEBUG, HERE, 
+            "accept=%d; sockfd=%d (%s); clilen=%d; cli_addr=%s\n",
+            newsockfd, l->fd, l->name, (int) clilen,
+            addr_str ( (struct sockaddr *) &cli_addr, client,
+                       sizeof(client), TRUE ) );
+
+    accept_count++;
+    l->accepted++;
+    if ( sb_hdr != NULL )
+        sb_hdr->h.accepts [ acceptor_id ] = accept_count;
+
+    if ( l->proxy )
+        proxy_add ( newsockfd, l, (struct sockaddr *) &cli_addr );
+    else
+        admit ( newsockfd, l, (struct sockaddr *) &cli_addr, NULL );
+}
+
+
+/*
+ * Checks a client from 'cli_addr' against the access rules and, if it
+ * is allowed, forks a session for it.  A connection that finished its
+ * PROXY header while accept() is paused, or while its listener has as
+ * many sessions as it may, is turned away as busy instead.  'accepted'
+ * is when accept() returned it, or NULL for just now.
+ */
+void
+admit ( int newsockfd, listener *l, struct sockaddr *cli_addr,
+        struct timeval *accepted )
+{
+    int            cls = -1;
+    pid_t          pid = 0;
+    char           client [ 64 ];
+    struct timeval tv;
+
+
+    if ( acl_permit ( cli_addr, &cls ) )
+    {
+        if ( overload_pause ( &tv ) != NULL ||
+             ( l->max_children > 0 && l->nchildren >= l->max_children ) )
+        {
+            TRACE ( trace_file, POP_DEBUG, HERE,
+                    "%s busy; turning away %s", l->name,
+                    addr_str ( cli_addr, client, sizeof(client), FALSE ) );
+            busy_reply ( newsockfd );
+        }
+        else
+            pid = motherforker ( newsockfd, l, ( cls != -1 ? cls : l->cls ),
+                                 cli_addr, rdns_lookup ( cli_addr ) );
+    }
+    else
+    {
+        l->denied++;
+        TRACE ( trace_file, POP_DEBUG, HERE,
+                "access denied to %s; closing fd %d",
+                addr_str ( cli_addr, client, sizeof(client), FALSE ),
+                newsockfd );
+        close ( newsockfd );
+    }
+    arrival_accept ( cli_addr, pid, accepted );
+}
+
+
 /*
  * Logs a message
  */
@@ -702,6 +1073,9 @@ err_dump ( WHENCE, const char *format, ... )
     fprintf ( err_out, "%s\n", msg_buf );
     logit   ( trace_file, POP_PRIORITY, fn, ln, "%s", msg_buf );
 
+    if ( ready_fd != -1 )
+        notify_ready ( 1, msg_buf );
+
     if ( Qargv_alloc )
     {
         free ( Qargv );
@@ -735,6 +1109,9 @@ err_msg ( WHENCE, const char *format, ... )
     int      iChunk = 0;
 
 
+    if ( errlog_suppress ( fn, ln, errno ) )
+        return;
+
     va_start ( ap, format );
 
     if ( pname != NULL )
@@ -765,6 +1142,119 @@ err_msg ( WHENCE, const char *format, ... )
 }
 
 
+/*
+ * Decides whether err_msg() should log an error from 'fn':'ln' with
+ * errno 'err'.  The first from a place (and errno) is logged; repeats
+ * within $QPOP_ERR_WINDOW seconds (default 10) are only counted, and
+ * the count is logged when the window closes (see errlog_flush()).  On
+ * top of that no more than ERRLOG_RATE error lines a second are
+ * written.  Suppressed messages are counted in the scoreboard.
+ * Returns TRUE to suppress.  Leaves errno alone.
+ */
+BOOL
+errlog_suppress ( const char *fn, int ln, int err )
+{
+    errlog_entry  *e   = NULL;
+    const char    *p   = NULL;
+    time_t         now = time ( NULL );
+    unsigned long  h   = ln + err * 131UL;
+
+
+    for ( p = fn; p != NULL && *p != '\0'; p++ )
+        h = h * 31 + (unsigned char) *p;
+    e = &errlog [ h % ERRLOG_SLOTS ];
+
+    if ( e->fn != NULL && e->ln == ln && e->err == err &&
+         strcmp ( e->fn, fn ) == 0 && now - e->since < errlog_window )
+    {
+        if ( e->repeats++ == 0 )
+            errlog_pending++;
+    }
+    else
+    {
+        /*
+         * New message (or the window is over, or another message had
+         * this slot): report any repeats of the old one first.
+         */
+        errlog_close ( e );
+
+        if ( now != errlog_sec )
+        {
+            errlog_sec   = now;
+            errlog_lines = 0;
+        }
+        if ( errlog_lines < ERRLOG_RATE )
+        {
+            errlog_lines++;
+            e->fn      = fn;
+            e->ln      = ln;
+            e->err     = err;
+            e->since   = now;
+            e->repeats = 0;
+            errno      = err;
+            return FALSE;
+        }
+
+        if ( errlog_dropped++ == 0 )
+            errlog_pending++;
+    }
+
+    errors_suppressed++;
+    if ( sb_hdr != NULL )
+        SB_COUNT ( sb_hdr, errors_suppressed, 1 );
+    errno = err;
+    return TRUE;
+}
+
+
+/*
+ * Logs how often the message in 'e' was repeated (if it was), and
+ * frees the entry.
+ */
+void
+errlog_close ( errlog_entry *e )
+{
+    if ( e->fn != NULL && e->repeats > 0 )
+    {
+        msg ( e->fn, e->ln, "last error (errno %d) repeated %lu times",
+              e->err, e->repeats );
+        errlog_pending--;
+    }
+    e->fn      = NULL;
+    e->repeats = 0;
+}
+
+
+/*
+ * Logs the repeat counts whose window has closed, or all of them if
+ * 'all', and the number of errors dropped for the rate limit.
+ */
+void
+errlog_flush ( BOOL all )
+{
+    time_t now = 0;
+    int    i   = 0;
+
+
+    if ( errlog_pending == 0 )
+        return;
+
+    now = time ( NULL );
+    for ( i = 0; i < ERRLOG_SLOTS; i++ )
+        if ( errlog [ i ].repeats > 0 &&
+             ( all || now - errlog [ i ].since >= errlog_window ) )
+            errlog_close ( &errlog [ i ] );
+
+    if ( errlog_dropped > 0 && ( all || now != errlog_sec ) )
+    {
+        msg ( HERE, "%lu error messages not logged (over %d a second)",
+              errlog_dropped, ERRLOG_RATE );
+        errlog_dropped = 0;
+        errlog_pending--;
+    }
+}
+
+
 void
 my_perror()
 {
@@ -793,28 +1283,68 @@ sys_err_str()
 }
 
 
+/*
+ * SIGCHLD handler.  Just notes that there are children to reap; the
+ * main loop calls reap_children().  The handler is re-installed only
+ * after reaping, since on System V re-installing it while zombies are
+ * waiting raises SIGCHLD again at once.
+ */
 int
 reaper ( SIGPARAM )
 {
-    int   stts;
-    pid_t child_pid = 0;
-
+    bReap = TRUE;
+    return 0;
+}
 
-    TRACE  ( trace_file, POP_DEBUG, HERE, "reaper signal handler called" );
 
-    do
+/*
+ * Collects exited children and forgets about them.
+ */
+void
+reap_children ( void )
+{
+    int             stts;
+    pid_t           child_pid = 0;
+    int             i         = 0;
+    struct rusage   ru;
+
+
+    TRACE  ( trace_file, POP_DEBUG, HERE, "reaping children" );
+    bReap = FALSE;
+
+    do
     {
-        child_pid = wait3 ( &stts, WNOHANG, (struct rusage *) 0 );
+        child_pid = wait3 ( &stts, WNOHANG, &ru );
         TRACE  ( trace_file, POP_DEBUG, HERE, 
                  "...wait3() returned %d; error: %s (%d) ",
                  child_pid,
                  ( child_pid > 0 ? "" : STRERROR(errno) ), 
                  ( child_pid > 0 ?  0 : errno ) );
+        if ( child_pid <= 0 )
+            break;
+
+        for ( i = 1; i < nacceptors; i++ )
+        {
+            if ( acceptor_pids [ i ] == child_pid )
+            {
+                msg ( HERE, "acceptor %d (pid %d) exited; status %#x",
+                      i, (int) child_pid, stts );
+                acceptor_pids [ i ] = 0;
+            }
+        }
+
+        i = child_find ( child_pid );
+        if ( i == -1 )
+            continue;
+
+        child_release ( i );
+        class_done    ( children [ i ].cls, &ru, &children [ i ].start );
+        arrival_done  ( child_pid, &children [ i ].start );
+        child_remove  ( i );
     }
         while  ( child_pid > 0 );
 
     signal ( SIGCHLD, VOIDSTAR reaper );
-    return 0;
 }
 
 
@@ -881,26 +1411,1176 @@ roll_it ( void )
 
 
 /*
- * Handles new client connection
+ * Parses a listen address given as "addr:port", "addr", ":port" or
+ * "port", e.g., "199.46.50.7:8110" or "8110".  'addr' and 'port' are
+ * in network order; whichever part is omitted keeps the value passed
+ * in.  Returns 0, or -1 if the address or port is invalid.
+ */
+int
+parse_listen_addr ( const char *spec, unsigned long *addr,
+                    unsigned short *port )
+{
+    const char    *ptr = spec;
+    char          *end = NULL;
+    unsigned long  a   = *addr;
+    long           n   = ntohs ( *port );
+    char           b [ 16 ] = "";
+    size_t         len = 0;
+
+
+    /*
+     * We might have an ip address first
+     */
+    if ( strchr ( spec, '.' ) != NULL )
+    {
+        len = strspn ( spec, ".0123456789" );
+        if ( len >= sizeof(b) )
+            return -1;
+        memcpy ( b, spec, len );
+        b [ len ] = '\0';
+    }
+
+    if ( *b != '\0' )
+    {
+        a   = inet_addr ( b );
+        ptr = spec + len;
+        if ( *ptr != '\0' && *ptr != ':' )
+            return -1;
+        ptr = ( *ptr == ':' ? ptr + 1 : NULL );
+    }
+    else
+    if ( *ptr == ':' )
+        ptr++;
+
+    /*
+     * We might have a port number
+     */
+    if ( ptr != NULL )
+    {
+        n = strtol ( ptr, &end, 10 );
+        if ( end == ptr || *end != '\0' )
+            return -1;
+    }
+
+    if ( a == BAD_ADDR || n <= 0 || n > USHRT_MAX )
+        return -1;
+
+    *addr = a;
+    *port = htons ( (unsigned short) n );
+    return 0;
+}
+
+
+/*
+ * Parses one listener: "addr:port" as for parse_listen_addr(), or
+ * "[v6addr]:port" / "[v6addr]" for IPv6, optionally followed by
+ * '/'-separated options:
+ *
+ *     backlog=N   listen() queue length (default 5; 0 also means the
+ *                 default)
+ *     max=N       at most N sessions at once from this listener (per
+ *                 acceptor); when reached, its connections wait in the
+ *                 listen queue
+ *     class=NAME  scheduling class for its sessions (see class_load())
+ *     proxy=1     connections start with a PROXY protocol header (see
+ *                 proxy_add())
+ *
+ * e.g., "[::]:110/backlog=128/max=500".  Returns 0, or -1 if invalid.
+ */
+int
+parse_listen_spec ( const char *spec, listener *l )
+{
+    struct sockaddr_in  *sin  = (struct sockaddr_in  *) &l->addr;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &l->addr;
+    char                 b [ 128 ] = "";
+    char                *opt  = NULL;
+    char                *next = NULL;
+    char                *end  = NULL;
+    char                *ptr  = NULL;
+    unsigned long        addr = sin->sin_addr.s_addr;
+    unsigned short       port = sin->sin_port;
+    long                 n    = 0;
+
+
+    if ( strlen ( spec ) >= sizeof(b) )
+        return -1;
+    strcpy ( b, spec );
+
+    opt = strchr ( b, '/' );
+    if ( opt != NULL )
+        *opt++ = '\0';
+
+    if ( *b == '[' )
+    {
+        ptr = strchr ( b, ']' );
+        if ( ptr == NULL )
+            return -1;
+        *ptr++ = '\0';
+        if ( *ptr == ':' )
+        {
+            n = strtol ( ++ptr, &end, 10 );
+            if ( end == ptr || *end != '\0' || n <= 0 || n > USHRT_MAX )
+                return -1;
+            port = htons ( (unsigned short) n );
+        }
+        else
+        if ( *ptr != '\0' )
+            return -1;
+
+        bzero ( (char *) sin6, sizeof(*sin6) );
+        if ( inet_pton ( AF_INET6, b + 1, &sin6->sin6_addr ) != 1 )
+            return -1;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port   = port;
+        l->addrlen        = sizeof(*sin6);
+    }
+    else
+    {
+        if ( parse_listen_addr ( b, &addr, &port ) == -1 )
+            return -1;
+        sin->sin_addr.s_addr = addr;
+        sin->sin_port        = port;
+    }
+
+    for ( ; opt != NULL; opt = next )
+    {
+        next = strchr ( opt, '/' );
+        if ( next != NULL )
+            *next++ = '\0';
+
+        ptr = strchr ( opt, '=' );
+        if ( ptr == NULL )
+            return -1;
+        *ptr++ = '\0';
+
+        if ( strcmp ( opt, "class" ) == 0 )
+        {
+            l->cls = class_find ( ptr );
+            if ( l->cls == -1 )
+                return -1;
+            continue;
+        }
+
+        n = strtol ( ptr, &end, 10 );
+        if ( end == ptr || *end != '\0' || n < 0 || n > INT_MAX )
+            return -1;
+
+        if ( strcmp ( opt, "backlog" ) == 0 )
+            l->backlog = ( n > 0 ? (int) n : LISTEN_BACKLOG );
+        else
+        if ( strcmp ( opt, "proxy" ) == 0 )
+            l->proxy = ( n != 0 );
+        else
+        if ( strcmp ( opt, "max" ) == 0 )
+            l->max_children = (int) n;
+        else
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Sets up the listeners from our arguments.  These are groups
+ * separated by lone "+" arguments; each group is a listen address (see
+ * parse_listen_spec()) followed by the arguments Qpopper gets for
+ * connections to it.  The first group's address may be left out, to
+ * listen on all addresses on the default port.
+ *
+ * Any lone "+" starts a new group, so Qpopper can't be given "+" itself
+ * as an argument (none of its options takes one).
+ */
+void
+parse_listeners ( int argc, char *argv[] )
+{
+    struct sockaddr_in *sin   = NULL;
+    listener           *l     = NULL;
+    char              **av    = NULL;
+    char               *ptr   = NULL;
+    int                 ngrp  = 1;
+    int                 n     = 0;
+    int                 i     = 0;
+    int                 k     = 0;
+
+
+    for ( i = 1; i < argc; i++ )
+        if ( strcmp ( argv [ i ], "+" ) == 0 )
+            ngrp++;
+    if ( ngrp > MAX_LISTENERS )
+        err_dump ( HERE, "at most %d listeners allowed", MAX_LISTENERS );
+
+    /*
+     * Each group's argv gets argv[0] and a terminating NULL
+     */
+    av = malloc ( sizeof(char *) * ( argc + 2 * ngrp ) );
+    if ( av == NULL )
+        err_dump ( HERE, "unable to allocate memory" );
+    Qargv       = av;
+    Qargv_alloc = TRUE;
+
+    i = 1;
+    for ( nlisteners = 0; nlisteners < ngrp; nlisteners++ )
+    {
+        l = &listeners [ nlisteners ];
+        bzero ( (char *) l, sizeof(*l) );
+        sin = (struct sockaddr_in *) &l->addr;
+        sin->sin_family      = AF_INET;
+        sin->sin_addr.s_addr = htonl ( INADDR_ANY );
+        sin->sin_port        = htons ( SERV_TCP_PORT );
+        l->addrlen           = sizeof(*sin);
+        l->backlog           = LISTEN_BACKLOG;
+        l->fd                = -1;
+        for ( k = 0; k < MAX_ACCEPTORS; k++ )
+            l->fds [ k ] = -1;
+
+        /*
+         * The group may start with an IP address and/or a port
+         * number (which we consume); if not, we use defaults.
+         */
+        ptr = ( i < argc ? argv [ i ] : "" );
+        if ( *ptr == ':' || *ptr == '[' || isdigit ( (int) *ptr ) )
+        {
+            if ( parse_listen_spec ( ptr, l ) == -1 )
+                err_dump ( HERE, "invalid address and/or port: \"%s\"", ptr );
+            i++;
+        }
+        else
+        if ( nlisteners > 0 )
+            err_dump ( HERE, "expected an address and/or port after \"+\"" );
+
+        addr_str ( (struct sockaddr *) &l->addr, l->name, sizeof(l->name), TRUE );
+        for ( k = 0; k < nlisteners; k++ )
+            if ( strcmp ( listeners [ k ].name, l->name ) == 0 )
+                err_dump ( HERE, "%s given more than once", l->name );
+
+        l->argv = av + n;
+        av [ n++ ] = argv [ 0 ];
+        while ( i < argc && strcmp ( argv [ i ], "+" ) != 0 )
+            av [ n++ ] = argv [ i++ ];
+        av [ n++ ] = NULL;
+        l->argc = (int) ( av + n - 1 - l->argv );
+        i++;    /* the "+" */
+    }
+
+    Qargc = listeners [ 0 ].argc;
+}
+
+
+/*
+ * Formats an address (and port) numerically, as "a.b.c.d:port" or
+ * "[v6addr]:port".  Returns 'buf'.
+ */
+char *
+addr_str ( struct sockaddr *sa, char *buf, size_t size, BOOL port )
+{
+    char      host [ INET6_ADDRSTRLEN ] = "?";
+    char      serv [ 8 ]                = "0";
+    socklen_t len = ( sa->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6)
+                                                : sizeof(struct sockaddr_in) );
+
+
+    getnameinfo ( sa, len, host, sizeof(host), serv, sizeof(serv),
+                  NI_NUMERICHOST | NI_NUMERICSERV );
+
+    if ( port == FALSE )
+        Qsnprintf ( buf, size, "%s", host );
+    else
+    if ( sa->sa_family == AF_INET6 )
+        Qsnprintf ( buf, size, "[%s]:%s", host, serv );
+    else
+        Qsnprintf ( buf, size, "%s:%s", host, serv );
+    return buf;
+}
+
+
+/*
+ * Opens, binds and listens on a non-blocking stream socket for 'l'.
+ * Returns the socket, or -1 if the address is in use (after saying
+ * so).  Other failures are fatal.
+ */
+int
+open_listener ( listener *l, BOOL reuseport )
+{
+    int sockfd   = -1;
+    int fd_flags =  0;
+    int rslt     =  0;
+    int i        =  1;
+
+
+    sockfd = socket ( l->addr.ss_family, SOCK_STREAM, 0 );
+    if ( sockfd < 0 )
+        err_dump ( HERE, "Can't open stream socket for %s", l->name );
+    TRACE ( trace_file, POP_DEBUG, HERE, "opened stream socket; sockfd = %d", sockfd );
+ 
+    rslt = setsockopt ( sockfd, SOL_SOCKET, SO_REUSEADDR, 
+                        (char *) &i, sizeof(i) );
+    if ( rslt == -1 )
+        err_dump ( HERE, "setsockopt(SO_REUSEADDR) failed" );
+
+    if ( reuseport )
+    {
+#ifdef    SO_REUSEPORT
+        rslt = setsockopt ( sockfd, SOL_SOCKET, SO_REUSEPORT,
+                            (char *) &i, sizeof(i) );
+        if ( rslt == -1 )
+            err_dump ( HERE, "setsockopt(SO_REUSEPORT) failed" );
+#else
+        err_dump ( HERE, "multiple acceptors need SO_REUSEPORT" );
+#endif /* SO_REUSEPORT */
+    }
+
+#ifdef    IPV6_V6ONLY
+    /*
+     * An IPv6 listener only takes IPv6 connections, so it can share a
+     * port with an IPv4 listener.
+     */
+    if ( l->addr.ss_family == AF_INET6 )
+    {
+        rslt = setsockopt ( sockfd, IPPROTO_IPV6, IPV6_V6ONLY,
+                            (char *) &i, sizeof(i) );
+        if ( rslt == -1 )
+            err_dump ( HERE, "setsockopt(IPV6_V6ONLY) failed" );
+    }
+#endif /* IPV6_V6ONLY */
+
+    if ( debug )
+    {
+        rslt = setsockopt ( sockfd, SOL_SOCKET, SO_DEBUG,
+                            (char *) &i, sizeof(i) );
+        if ( rslt == -1 )
+            TRACE ( trace_file, POP_DEBUG, HERE, 
+                    "%s: Server: setsockopt(SO_DEBUG) failed", pname );
+    }
+
+    /*
+     * Buffer sizes must be on the listening socket to affect the
+     * window scale offered in the handshake; accepted sockets
+     * inherit them.
+     */
+    apply_sock_policy ( sockfd, &sock_pol, TRUE );
+
+    TRACE ( trace_file, POP_DEBUG, HERE, "set stream socket options; sockfd = %d", sockfd );
+
+    rslt = bind ( sockfd, (struct sockaddr *) &l->addr, l->addrlen );
+    if ( rslt < 0 )
+    {
+        if ( errno == EADDRINUSE )
+        {
+            fprintf ( stderr, "%s in use\n", l->name );
+            Qsnprintf ( msg_buf, sizeof(msg_buf), "%s: %s in use",
+                        pname, l->name );
+            notify_ready ( 1, msg_buf );
+            close ( sockfd );
+            return -1;
+        }
+        else
+            err_dump ( HERE, "Can't bind local address %s", l->name );
+    }
+
+    TRACE ( trace_file, POP_DEBUG, HERE,
+            "did bind on stream socket; sockfd = %d",
+            sockfd );
+
+    rslt = listen ( sockfd, l->backlog );
+    if ( rslt == -1 )
+        err_dump ( HERE, "listen() failed on sockfd %d", sockfd );
+
+    /*
+     * Set file descriptor to be non-blocking in case there isn't really a
+     * connection available if the select succeeds.  This avoids us
+     * blocking there.
+     */
+    fd_flags = fcntl ( sockfd, F_GETFL, 0 );
+    rslt     = fcntl ( sockfd, F_SETFL, O_NONBLOCK | fd_flags );
+    if ( rslt == -1 )
+        err_dump ( HERE, "Unable to set sockfd(%d) to be non-blocking",
+                   sockfd );
+    TRACE ( trace_file, POP_DEBUG, HERE, "set fd %d non-blocking (%#x)",
+            sockfd, fcntl ( sockfd, F_GETFL, 0 ) );
+
+    return sockfd;
+}
+
+
+/*
+ * Closes all our listening sockets (e.g., in a child)
+ */
+void
+close_listeners ( void )
+{
+    listener *l = NULL;
+    int       i = 0;
+    int       j = 0;
+
+
+    for ( j = 0; j < nlisteners; j++ )
+    {
+        l = &listeners [ j ];
+        for ( i = 0; i < nacceptors; i++ )
+        {
+            if ( l->fds [ i ] != -1 )
+                close ( l->fds [ i ] );
+            l->fds [ i ] = -1;
+        }
+        l->fd = -1;
+    }
+}
+
+
+/*
+ * Logs each listener's counters
+ */
+void
+listener_report ( void )
+{
+    listener *l = NULL;
+    int       j = 0;
+
+
+    for ( j = 0; j < nlisteners; j++ )
+    {
+        l = &listeners [ j ];
+        msg ( HERE, "listener %s: %lu accepted, %lu denied, %lu forked, "
+                    "%lu fork failures; %d sessions (max %d, reached %lu times)",
+              l->name, l->accepted, l->denied, l->forked, l->fork_failed,
+              l->nchildren, l->max_children, l->full_count );
+    }
+}
+
+
+/*
+ * Makes an accepted connection Qpopper's stdin, stdout and stderr.
+ */
+void
+hand_off_socket ( int newsockfd )
+{
+    int fd_flags = 0;
+    int rslt     = 0;
+
+
+    /*
+     * Make sure we pass a blocking socket to Qpopper
+     */
+    fd_flags = fcntl ( newsockfd, F_GETFL, 0 );
+    TRACE ( trace_file, POP_DEBUG, HERE, "newsockfd (%d) flags: %#x",
+             newsockfd, fd_flags );
+    if ( fd_flags & O_NONBLOCK )
+    {
+        rslt = fcntl ( newsockfd, F_SETFL, fd_flags & ~O_NONBLOCK );
+        if ( rslt == -1 )
+            err_dump ( HERE, "Unable to set newsockfd (%d) to be blocking",
+                       newsockfd );
+        TRACE ( trace_file, POP_DEBUG, HERE, "set fd %d blocking (%#x)",
+                newsockfd, fcntl ( newsockfd, F_GETFL, 0 ) );
+    }
+
+    dup2    ( newsockfd, 0 );
+    dup2    ( newsockfd, 1 );
+    dup2    ( newsockfd, 2 );
+    close   ( newsockfd    );
+}
+
+
+/*
+ * Returns the value of environment variable 'name' as a number, or
+ * 'dflt' if it isn't set or isn't numeric.
+ */
+long
+env_long ( const char *name, long dflt )
+{
+    char *val = getenv ( name );
+    char *end = NULL;
+    long  n   = 0;
+
+
+    if ( val == NULL || *val == '\0' )
+        return dflt;
+
+    n = strtol ( val, &end, 0 );
+    if ( *end != '\0' )
+    {
+        msg ( HERE, "ignoring non-numeric %s=\"%s\"", name, val );
+        return dflt;
+    }
+    return n;
+}
+
+
+/*
+ * Reads one socket policy setting: -1 if it isn't set, otherwise a
+ * number from 'min' to 'max'.  Anything else (a zero or negative size
+ * or interval, say) is a configuration error, not something to hand
+ * to setsockopt().
+ */
+static int
+sock_opt_env ( const char *name, long min, long max )
+{
+    char *val = getenv ( name );
+    char *end = NULL;
+    long  n   = 0;
+
+
+    if ( val == NULL || *val == '\0' )
+        return -1;
+
+    n = strtol ( val, &end, 0 );
+    if ( end == val || *end != '\0' || n < min || n > max )
+        err_dump ( HERE, "%s must be %ld to %ld, not \"%s\"",
+                   name, min, max, val );
+    return (int) n;
+}
+
+
+/*
+ * Reads the per-connection socket policy from the environment:
+ * QPOP_SNDBUF, QPOP_RCVBUF, QPOP_NODELAY, QPOP_NOTSENT_LOWAT,
+ * QPOP_KEEPALIVE, QPOP_KEEPIDLE, QPOP_KEEPINTVL, QPOP_KEEPCNT and
+ * QPOP_USER_TIMEOUT.  Sizes, intervals and counts must be positive;
+ * QPOP_NODELAY and QPOP_KEEPALIVE are 0 or 1.  Setting any keepalive
+ * interval turns keepalive on.
+ */
+void
+get_sock_policy ( sock_policy *pol )
+{
+    pol->sndbuf        = sock_opt_env ( "QPOP_SNDBUF",        1, INT_MAX );
+    pol->rcvbuf        = sock_opt_env ( "QPOP_RCVBUF",        1, INT_MAX );
+    pol->nodelay       = sock_opt_env ( "QPOP_NODELAY",       0, 1       );
+    pol->notsent_lowat = sock_opt_env ( "QPOP_NOTSENT_LOWAT", 1, INT_MAX );
+    pol->keepalive     = sock_opt_env ( "QPOP_KEEPALIVE",     0, 1       );
+    pol->keepidle      = sock_opt_env ( "QPOP_KEEPIDLE",      1, INT_MAX );
+    pol->keepintvl     = sock_opt_env ( "QPOP_KEEPINTVL",     1, INT_MAX );
+    pol->keepcnt       = sock_opt_env ( "QPOP_KEEPCNT",       1, INT_MAX );
+    pol->user_timeout  = sock_opt_env ( "QPOP_USER_TIMEOUT",  1, INT_MAX );
+
+    if ( pol->keepalive == -1 &&
+         ( pol->keepidle != -1 || pol->keepintvl != -1 || pol->keepcnt != -1 ) )
+        pol->keepalive = 1;
+}
+
+
+/*
+ * Sets one socket option if the policy specifies it.  Failure is
+ * traced but not fatal; the connection just keeps the default.
+ */
+static void
+set_opt ( int fd, int level, int name, const char *sname, int val )
+{
+    if ( val == -1 )
+        return;
+
+    if ( setsockopt ( fd, level, name, (char *) &val, sizeof(val) ) == -1 )
+    {
+        TRACE ( trace_file, POP_DEBUG, HERE,
+                "setsockopt(%s, %d) on fd %d failed: %s",
+                sname, val, fd, STRERROR(errno) );
+    }
+    else
+    {
+        TRACE ( trace_file, POP_DEBUG, HERE,
+                "set %s=%d on fd %d", sname, val, fd );
+    }
+}
+
+
+/*
+ * Applies the socket policy.  On the listening socket only the buffer
+ * sizes are set; the rest is applied to each accepted connection.
+ */
+void
+apply_sock_policy ( int fd, sock_policy *pol, BOOL listener )
+{
+    set_opt ( fd, SOL_SOCKET,  SO_SNDBUF,         "SO_SNDBUF",         pol->sndbuf );
+    set_opt ( fd, SOL_SOCKET,  SO_RCVBUF,         "SO_RCVBUF",         pol->rcvbuf );
+    if ( listener )
+        return;
+
+    set_opt ( fd, IPPROTO_TCP, TCP_NODELAY,       "TCP_NODELAY",       pol->nodelay );
+#ifdef    TCP_NOTSENT_LOWAT
+    set_opt ( fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, "TCP_NOTSENT_LOWAT", pol->notsent_lowat );
+#endif /* TCP_NOTSENT_LOWAT */
+    set_opt ( fd, SOL_SOCKET,  SO_KEEPALIVE,      "SO_KEEPALIVE",      pol->keepalive );
+#ifdef    TCP_KEEPIDLE
+    set_opt ( fd, IPPROTO_TCP, TCP_KEEPIDLE,      "TCP_KEEPIDLE",      pol->keepidle );
+#endif /* TCP_KEEPIDLE */
+#ifdef    TCP_KEEPINTVL
+    set_opt ( fd, IPPROTO_TCP, TCP_KEEPINTVL,     "TCP_KEEPINTVL",     pol->keepintvl );
+#endif /* TCP_KEEPINTVL */
+#ifdef    TCP_KEEPCNT
+    set_opt ( fd, IPPROTO_TCP, TCP_KEEPCNT,       "TCP_KEEPCNT",       pol->keepcnt );
+#endif /* TCP_KEEPCNT */
+#ifdef    TCP_USER_TIMEOUT
+    set_opt ( fd, IPPROTO_TCP, TCP_USER_TIMEOUT,  "TCP_USER_TIMEOUT",  pol->user_timeout );
+#endif /* TCP_USER_TIMEOUT */
+}
+
+
+/*
+ * Creates and maps the scoreboard file.  Failure is not fatal; we
+ * just run without a scoreboard.
+ */
+void
+sb_open ( const char *path, int nslots )
+{
+    int     fd   = -1;
+    size_t  size = 0;
+    void   *map  = NULL;
+
+
+    if ( nslots <= 0 )
+        nslots = SB_DEFAULT_SLOTS;
+    size = SB_SIZE ( nslots );
+
+    fd = open ( path, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( fd == -1 )
+    {
+        err_msg ( HERE, "Unable to create scoreboard \"%s\"", path );
+        return;
+    }
+
+    if ( ftruncate ( fd, size ) == -1 )
+    {
+        err_msg ( HERE, "Unable to size scoreboard \"%s\" to %lu bytes",
+                  path, (unsigned long) size );
+        close ( fd );
+        return;
+    }
+
+    map = mmap ( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close ( fd );
+    if ( map == MAP_FAILED )
+    {
+        err_msg ( HERE, "Unable to map scoreboard \"%s\"", path );
+        return;
+    }
+
+    memset ( map, 0, size );
+    sb_hdr                = (sb_hdr_t *) map;
+    sb_nslots             = nslots;
+    sb_hdr->h.version     = SB_VERSION;
+    sb_hdr->h.nslots      = nslots;
+    sb_hdr->h.hdr_size    = SB_HDR_SIZE;
+    sb_hdr->h.slot_size   = SB_SLOT_SIZE;
+    sb_hdr->h.master_pid  = getpid();
+    sb_hdr->h.started     = time ( NULL );
+    SB_BARRIER();
+    sb_hdr->h.magic       = SB_MAGIC;
+
+    TRACE ( trace_file, POP_DEBUG, HERE,
+            "mapped scoreboard \"%s\": %d slots, %lu bytes",
+            path, nslots, (unsigned long) size );
+}
+
+
+/*
+ * Claims a free scoreboard slot for a connection about to be forked.
+ * Slots whose owner died without being reaped (e.g., the master crashed)
+ * are reused.  Each acceptor claims only slots whose index modulo the
+ * number of acceptors is its own id, so acceptors never race for a
+ * slot.  Returns the slot index, or -1 if none is available.
+ */
+int
+sb_claim ( void )
+{
+    sb_slot_t *sp  = NULL;
+    time_t     now = 0;
+    int        i   = 0;
+    int        n   = 0;
+
+
+    if ( sb_hdr == NULL )
+        return -1;
+
+    now = time ( NULL );
+    for ( n = 0; n < sb_nslots; n++ )
+    {
+        i  = ( sb_hint + n ) % sb_nslots;
+        if ( i % nacceptors != acceptor_id )
+            continue;   /* another acceptor's */
+        sp = SB_SLOT ( sb_hdr, i );
+
+        if ( sp->s.state != SB_FREE )
+        {
+            if ( sp->s.pid > 0 )
+            {
+                if ( kill ( (pid_t) sp->s.pid, 0 ) == 0 || errno != ESRCH )
+                    continue;
+            }
+            else
+            if ( now - sp->s.started < 60 )
+                continue;
+        }
+
+        sb_begin ( sp );
+        sp->s.pid         = -1;
+        sp->s.state       = SB_STARTING;
+        sp->s.client[0]   = '\0';
+        sp->s.started     = now;
+        sb_end   ( sp );
+
+        sb_hint = ( i + 1 ) % sb_nslots;
+        return i;
+    }
+
+    return -1;
+}
+
+
+/*
+ * Frees the slot held by a reaped child, unless the child already
+ * did (or the slot went to someone else since).
+ */
+void
+sb_release ( int slot, pid_t pid )
+{
+    sb_slot_t *sp = NULL;
+
+
+    if ( sb_hdr == NULL || slot < 0 || slot >= sb_nslots )
+        return;
+
+    sp = SB_SLOT ( sb_hdr, slot );
+    if ( sp->s.state != SB_FREE && ( sp->s.pid == (long) pid || sp->s.pid == -1 ) )
+    {
+        sb_begin ( sp );
+        sp->s.state = SB_FREE;
+        sp->s.pid   = 0;
+        sb_end   ( sp );
+    }
+}
+
+
+/*
+ * (Re)opens the connection arrival log named by $QPOP_ARRIVALS.  Each
+ * accepted connection adds a line
+ *
+ *     A <time> <client-hash> <pid>
+ *
+ * (pid 0 if no child was forked), and each reaped child
+ *
+ *     D <time> <pid> <session-milliseconds>
+ *
+ * Times are seconds.microseconds since the epoch; an arrival's is when
+ * the connection was accepted, even if it then waited for a PROXY
+ * header.  The client hash is
+ * FNV-1a over $QPOP_ARRIVALS_SALT and the address, so repeat clients
+ * can be recognized without logging addresses.  popreplay reads this.
+ *
+ * Several acceptors may share the log, so it is opened O_APPEND and
+ * each line goes out in a single write(), unbuffered, so lines never
+ * interleave.
+ */
+void
+arrival_open ( void )
+{
+    char *path = getenv ( "QPOP_ARRIVALS" );
+
+
+    if ( path == NULL || *path == '\0' )
+        return;
+
+    if ( arrival_fd != -1 )
+        close ( arrival_fd );
+
+    arrival_fd = open ( path, O_WRONLY | O_APPEND | O_CREAT, 0666 );
+    if ( arrival_fd == -1 )
+        err_msg ( HERE, "Unable to open arrival log \"%s\"", path );
+}
+
+
+/*
+ * Appends one line to the arrival log
+ */
+void
+arrival_write ( const char *line, int len )
+{
+    if ( len <= 0 || write ( arrival_fd, line, len ) != len )
+        TRACE ( trace_file, POP_DEBUG, HERE, "arrival log write failed" );
+}
+
+
+void
+arrival_accept ( struct sockaddr *sa, pid_t pid, struct timeval *when )
+{
+    static const char *salt = NULL;
+    unsigned char      key [ 16 ];
+    unsigned long      h    = 2166136261UL;
+    const char        *p    = NULL;
+    int                len  = 0;
+    int                i    = 0;
+    struct timeval     now;
+    char               line [ 64 ];
+
+
+    if ( arrival_fd == -1 )
+        return;
+
+    if ( salt == NULL )
+    {
+        salt = getenv ( "QPOP_ARRIVALS_SALT" );
+        if ( salt == NULL )
+            salt = "";
+    }
+
+    for ( p = salt; *p != '\0'; p++ )
+        h = ( ( h ^ (unsigned char) *p ) * 16777619UL ) & 0xffffffffUL;
+
+    len = addr_key ( sa, key );
+    for ( i = 0; i < len; i++ )
+        h = ( ( h ^ key [ i ] ) * 16777619UL ) & 0xffffffffUL;
+
+    if ( when != NULL )
+        now = *when;
+    else
+        gettimeofday ( &now, NULL );
+    len = Qsnprintf ( line, sizeof(line), "A %ld.%06ld %08lx %d\n",
+                      (long) now.tv_sec, (long) now.tv_usec, h,
+                      (int) ( pid > 0 ? pid : 0 ) );
+    arrival_write ( line, len );
+}
+
+
+void
+arrival_done ( pid_t pid, struct timeval *start )
+{
+    struct timeval now;
+    char           line [ 64 ];
+    int            len  = 0;
+
+
+    if ( arrival_fd == -1 )
+        return;
+
+    gettimeofday ( &now, NULL );
+    len = Qsnprintf ( line, sizeof(line), "D %ld.%06ld %d %ld\n",
+                      (long) now.tv_sec, (long) now.tv_usec, (int) pid,
+                      (long) ( ( now.tv_sec  - start->tv_sec  ) * 1000 +
+                               ( now.tv_usec - start->tv_usec ) / 1000 ) );
+    arrival_write ( line, len );
+}
+
+
+/*
+ * Called when we couldn't fork() for a connection (typically EAGAIN
+ * from RLIMIT_NPROC, or ENOMEM), or accept() one (see fd_exhausted()).
+ * Tells the client to try later, closes the connection (if any), and
+ * pauses accept() for an exponentially growing interval rather than
+ * dying.
  */
 void
-motherforker ( int newsockfd, int sockfd )
+overload_begin ( int newsockfd, const char *why )
+{
+    struct timeval now;
+
+
+    if ( newsockfd != -1 )
+        busy_reply ( newsockfd );
+
+    overload_pauses++;
+    if ( sb_hdr != NULL )
+        SB_COUNT ( sb_hdr, overload_pauses, 1 );
+    if ( overload_delay == 0 )
+        overload_delay = OVERLOAD_MIN_DELAY;
+    else
+    if ( overload_delay < OVERLOAD_MAX_DELAY )
+    {
+        overload_delay *= 2;
+        if ( overload_delay > OVERLOAD_MAX_DELAY )
+            overload_delay = OVERLOAD_MAX_DELAY;
+    }
+
+    gettimeofday ( &now, NULL );
+    overload_until.tv_sec  = now.tv_sec  + overload_delay / 1000;
+    overload_until.tv_usec = now.tv_usec + ( overload_delay % 1000 ) * 1000;
+    if ( overload_until.tv_usec >= 1000000 )
+    {
+        overload_until.tv_sec++;
+        overload_until.tv_usec -= 1000000;
+    }
+
+    msg ( HERE, "overloaded (%s); not accepting for %ldms "
+                "(%lu fork failures, %lu times out of fds)",
+          why, overload_delay, fork_failures, fd_exhaustions );
+}
+
+
+/*
+ * Tells a client we can't serve it now and closes the connection.
+ * Best effort: the socket is made non-blocking (accept() doesn't pass
+ * that on everywhere) so a slow client can't stall us, and a short
+ * write just means the client sees the connection close.
+ */
+void
+busy_reply ( int newsockfd )
+{
+    fcntl ( newsockfd, F_SETFL, O_NONBLOCK | fcntl ( newsockfd, F_GETFL, 0 ) );
+    if ( write ( newsockfd, OVERLOAD_BUSY_RESP,
+                 strlen ( OVERLOAD_BUSY_RESP ) ) == -1 )
+        TRACE ( trace_file, POP_DEBUG, HERE, "unable to send busy response" );
+    close ( newsockfd );
+}
+
+
+/*
+ * Called when accept() fails with EMFILE or ENFILE.  The connection is
+ * still pending, so select() would wake us again at once; instead we
+ * give up the reserve descriptor, accept the connection with it, turn
+ * the client away, and take the reserve back.  Then accept() pauses
+ * as after a fork() failure.  If the reserve couldn't be re-armed last
+ * time the connection stays queued, but the pause still keeps us from
+ * spinning.
+ */
+void
+fd_exhausted ( listener *l )
+{
+    int newsockfd = -1;
+
+
+    fd_exhaustions++;
+    if ( sb_hdr != NULL )
+        SB_COUNT ( sb_hdr, fd_exhaustions, 1 );
+
+    if ( reserve_fd == -1 )
+        reserve_fd = open ( "/dev/null", O_RDONLY );
+
+    if ( reserve_fd != -1 )
+    {
+        close ( reserve_fd );
+        reserve_fd = -1;
+        newsockfd  = accept ( l->fd, NULL, NULL );
+        TRACE ( trace_file, POP_DEBUG, HERE,
+                "out of fds; turning away connection on %s (fd %d)",
+                l->name, newsockfd );
+    }
+
+    overload_begin ( newsockfd, "out of file descriptors" );
+
+    reserve_fd = open ( "/dev/null", O_RDONLY );
+    if ( reserve_fd == -1 )
+        TRACE ( trace_file, POP_DEBUG, HERE,
+                "unable to re-arm reserve descriptor: %s", STRERROR(errno) );
+}
+
+
+/*
+ * Called after a successful fork() while backing off.
+ */
+void
+overload_end ( void )
+{
+    msg ( HERE, "recovered from overload (%lu fork failures, %lu pauses)",
+          fork_failures, overload_pauses );
+    overload_delay = 0;
+}
+
+
+/*
+ * If accept() is paused, returns 'tv' set to the time remaining;
+ * otherwise NULL.
+ */
+struct timeval *
+overload_pause ( struct timeval *tv )
+{
+    struct timeval now;
+
+
+    if ( overload_delay == 0 )
+        return NULL;
+
+    gettimeofday ( &now, NULL );
+    tv->tv_sec  = overload_until.tv_sec  - now.tv_sec;
+    tv->tv_usec = overload_until.tv_usec - now.tv_usec;
+    if ( tv->tv_usec < 0 )
+    {
+        tv->tv_sec--;
+        tv->tv_usec += 1000000;
+    }
+
+    if ( tv->tv_sec < 0 )
+        return NULL;
+    return tv;
+}
+
+
+/*
+ * Run by the process that launched the daemon: waits for the daemon
+ * to report over the pipe, copies any message to stderr, and exits
+ * with the daemon's status.  The pipe closing without a status means
+ * the daemon died during start-up.
+ */
+void
+wait_ready ( int fd )
+{
+    char            buf [ 512 ];
+    int             status = -1;
+    int             n      = 0;
+    fd_set          fds;
+    struct timeval  tv;
+
+
+    while ( TRUE )
+    {
+        FD_ZERO ( &fds );
+        FD_SET  ( fd, &fds );
+        tv.tv_sec  = READY_TIMEOUT;
+        tv.tv_usec = 0;
+
+        n = select ( fd + 1, &fds, NULL, NULL, &tv );
+        if ( n == -1 && errno == EINTR )
+            continue;
+        if ( n == 0 )
+        {
+            fprintf ( stderr, "%s: daemon not ready after %d seconds\n",
+                      pname, READY_TIMEOUT );
+            exit ( 1 );
+        }
+
+        n = read ( fd, buf, sizeof(buf) );
+        if ( n == -1 && errno == EINTR )
+            continue;
+        if ( n <= 0 )
+            break;
+
+        if ( status == -1 )
+        {
+            status = (unsigned char) buf[0];
+            fwrite ( buf + 1, 1, n - 1, stderr );
+        }
+        else
+            fwrite ( buf, 1, n, stderr );
+    }
+
+    if ( status == -1 )
+    {
+        fprintf ( stderr, "%s: daemon exited during start-up\n", pname );
+        exit ( 1 );
+    }
+
+    exit ( status );
+}
+
+
+/*
+ * Reports start-up status: over the pipe to our launcher, if any, and
+ * (on success) to a supervisor listening on $NOTIFY_SOCKET, using the
+ * sd_notify() datagram protocol.  Only the first call does anything.
+ */
+void
+notify_ready ( int status, const char *text )
+{
+    static BOOL         bDone = FALSE;
+    char                buf [ 512 ];
+    char               *path  = NULL;
+    struct sockaddr_un  sun;
+    int                 fd    = -1;
+    int                 len   = 0;
+
+
+    if ( bDone )
+        return;
+    bDone = TRUE;
+
+    if ( ready_fd != -1 )
+    {
+        buf[0] = (char) status;
+        len    = 1;
+        if ( text != NULL )
+            len += Qsnprintf ( buf + 1, sizeof(buf) - 2, "%s\n", text );
+        if ( len > (int) sizeof(buf) - 1 )
+            len = sizeof(buf) - 1;
+        if ( write ( ready_fd, buf, len ) == -1 )
+            TRACE ( trace_file, POP_DEBUG, HERE, "unable to notify launcher" );
+        close ( ready_fd );
+        ready_fd = -1;
+    }
+
+    path = getenv ( "NOTIFY_SOCKET" );
+    if ( status != 0 || path == NULL ||
+         ( *path != '/' && *path != '@' ) ||
+         strlen ( path ) >= sizeof(sun.sun_path) )
+        return;
+
+    fd = socket ( AF_UNIX, SOCK_DGRAM, 0 );
+    if ( fd == -1 )
+        return;
+
+    bzero  ( (char *) &sun, sizeof(sun) );
+    sun.sun_family = AF_UNIX;
+    strcpy ( sun.sun_path, path );
+    len = offsetof ( struct sockaddr_un, sun_path ) + strlen ( path );
+    if ( *path == '@' )
+        sun.sun_path[0] = '\0';            /* abstract namespace */
+
+    Qsnprintf ( buf, sizeof(buf), "READY=1\nMAINPID=%d", (int) getpid() );
+    if ( sendto ( fd, buf, strlen ( buf ), 0,
+                  (struct sockaddr *) &sun, len ) == -1 )
+        TRACE ( trace_file, POP_DEBUG, HERE,
+                "unable to notify \"%s\": %s", path, STRERROR(errno) );
+    close ( fd );
+}
+
+
+/*
+ * Handles new client connection
+ */
+pid_t
+motherforker ( int newsockfd, listener *l, int cls,
+               struct sockaddr *cli_addr, char *peername )
 {
     int     childpid    = 0;
-    int     fd_flags    = 0;
-    int     rslt        = 0;
+    int     slot        = -1;
+    char    host [ 64 ];
+    char    port [ 8 ];
 
 
     TRACE ( trace_file, POP_DEBUG, HERE, "new connection; fd=%d", newsockfd );
 
+    slot = sb_claim();
+    if ( slot == -1 && sb_hdr != NULL )
+        TRACE ( trace_file, POP_DEBUG, HERE, "no free scoreboard slot" );
+
 #ifndef _DEBUG
     childpid = fork();
     if ( childpid < 0 )
-        err_dump ( HERE, "fork() error" );
+    {
+        err_msg ( HERE, "fork() error; turning away connection" );
+        l->fork_failed++;
+        fork_failures++;
+        if ( sb_hdr != NULL )
+            SB_COUNT ( sb_hdr, fork_failures, 1 );
+        if ( slot != -1 )
+        {
+            sb_slot_t *sp = SB_SLOT ( sb_hdr, slot );
+            sb_begin ( sp );
+            sp->s.state = SB_FREE;
+            sp->s.pid   = 0;
+            sb_end   ( sp );
+        }
+        overload_begin ( newsockfd, "fork() failed" );
+        return -1;
+    }
     
     else if ( childpid == 0 )
     { /* I'm the child */
         TRACE ( trace_file, POP_DEBUG, HERE, "new child for connection" );
+#endif /* not _DEBUG */
+
+        /*
+         * Take ownership of our scoreboard slot
+         */
+        if ( slot != -1 )
+        {
+            sb_me = SB_SLOT ( sb_hdr, slot );
+            sb_begin ( sb_me );
+            sb_me->s.pid   = (long) getpid();
+            sb_me->s.state = SB_RUNNING;
+            sb_me->s.lst   = (int) ( l - listeners );
+            sb_me->s.cls   = cls;
+            addr_str ( cli_addr, sb_me->s.client, SB_CLIENT_LEN, FALSE );
+            sb_end   ( sb_me );
+        }
+
+#ifndef _DEBUG
 
         /*
          * Children should not trap signals
@@ -910,44 +2590,79 @@ motherforker ( int newsockfd, int sockfd )
         signal ( SIGHUP,  SIG_DFL );
 
         /*
-         * We don't need sockfd
+         * We don't need the listening sockets, or the arrival log
          */
-        close ( sockfd );
-        sockfd = -1;
+        close_listeners();
+        if ( arrival_fd != -1 )
+        {
+            close ( arrival_fd );
+            arrival_fd = -1;
+        }
+        if ( rdns_fd != -1 )
+        {
+            close ( rdns_fd );
+            rdns_fd = -1;
+        }
+        if ( reserve_fd != -1 )
+        {
+            close ( reserve_fd );
+            reserve_fd = -1;
+        }
+        proxy_close_all();
 
 #endif /* not _DEBUG */
 
         /*
-         * Make sure we pass a blocking socket to Qpopper
+         * Pass on the client's name if we know it.  Qpopper doesn't
+         * read this yet (it does its own lookup); see rdns_helper().
+         */
+        if ( peername != NULL )
+            setenv   ( "QPOP_PEERNAME", peername, 1 );
+        else
+            unsetenv ( "QPOP_PEERNAME" );
+
+        /*
+         * Behind a load balancer, the client's real address is not
+         * the socket's peer
          */
-        fd_flags = fcntl ( newsockfd, F_GETFL, 0 );
-        TRACE ( trace_file, POP_DEBUG, HERE, "newsockfd (%d) flags: %#x",
-                 newsockfd, fd_flags );
-        if ( fd_flags & O_NONBLOCK )
+        if ( l->proxy )
         {
-            
-            rslt = fcntl ( newsockfd, F_SETFL, fd_flags - O_NONBLOCK );
-            if ( rslt == -1 )
-                err_dump ( HERE, "Unable to set newsockfd (%d) to be blocking",
-                           newsockfd );
-            TRACE ( trace_file, POP_DEBUG, HERE, "set fd %d blocking (%#x)",
-                    newsockfd, fcntl ( newsockfd, F_GETFL, 0 ) );
+            setenv ( "QPOP_PEERADDR",
+                     addr_str ( cli_addr, host, sizeof(host), FALSE ), 1 );
+            Qsnprintf ( port, sizeof(port), "%d",
+                        ntohs ( cli_addr->sa_family == AF_INET6
+                                ? ( (struct sockaddr_in6 *) cli_addr )->sin6_port
+                                : ( (struct sockaddr_in  *) cli_addr )->sin_port ) );
+            setenv ( "QPOP_PEERPORT", port, 1 );
+        }
+        else
+        {
+            unsetenv ( "QPOP_PEERADDR" );
+            unsetenv ( "QPOP_PEERPORT" );
         }
 
-        dup2    ( newsockfd, 0 );
-        dup2    ( newsockfd, 1 );
-        dup2    ( newsockfd, 2 );
-        close   ( newsockfd    );
+        apply_sock_policy ( newsockfd, &sock_pol, FALSE );
+        class_apply ( cls );
+
+        hand_off_socket ( newsockfd );
         newsockfd = -1;
-        qpopper ( Qargc, Qargv );
+        qpopper ( l->argc, l->argv );
             
 #ifdef _DEBUG
-        close  ( sockfd );
-        sockfd = -1;
+        close_listeners();
 #endif /* not _DEBUG */
 
         TRACE ( trace_file, POP_DEBUG, HERE, "exiting after Qpopper returned" );
 
+        if ( sb_me != NULL )
+        {
+            sb_begin ( sb_me );
+            sb_me->s.state = SB_FREE;
+            sb_me->s.pid   = 0;
+            sb_end   ( sb_me );
+            sb_me = NULL;
+        }
+
         if ( Qargv_alloc )
         {
             free ( Qargv );
@@ -968,10 +2683,16 @@ motherforker ( int newsockfd, int sockfd )
     { /* I'm the parent */
         TRACE ( trace_file, POP_DEBUG, HERE, "forked() for new connection; pid=%d",
                 childpid );
+        if ( overload_delay != 0 )
+            overload_end();
+        l->forked++;
+        child_add ( childpid, slot, (int) ( l - listeners ), cls, NULL );
         close ( newsockfd );
         newsockfd = -1;
     } /* I'm the parent */
 #endif /* not _DEBUG */
+
+    return childpid;
 }
 
 
@@ -0,0 +1,439 @@
+/*
+ * Copyright (c) 2001 QUALCOMM Incorporated.  All rights reserved.
+ * The file license.txt specifies the terms for use, modification,
+ * and redistribution.
+ *
+ * popbench: microbenchmarks for the per-connection work the standalone
+ * daemon does in main.c.  Linux only.  Build it in the popper
+ * directory, next to the Qpopper objects it needs:
+ *
+ *     cc -O2 -DSTANDALONE -I. -I.. -o popbench popbench.c \
+ *        acl.o children.o proxy.o rdns.o sched_class.o supervisor.o \
+ *        snprintf.o logit.o
+ *
+ * and run it with no arguments (or '-n <iterations>').  Each benchmark
+ * runs a warm-up pass and then REPEATS timed passes; the median and
+ * minimum nanoseconds per operation are printed one per line, in a
+ * fixed order and format, so the output of two builds can be diffed
+ * or compared by a script.  The process is pinned to one CPU to keep
+ * runs steady.
+ *
+ * The retr_* benchmarks time one RETR-sized transfer (a command in,
+ * RETR_SIZE bytes out in RETR_CHUNK writes) over TCP loopback to a
+ * forked reader, with each QPOP_* socket setting in turn applied on and
+ * off through apply_sock_policy(); "off" is the kernel default, or 0
+ * for the on/off options.  Everything but the setting under test is
+ * left at the kernel default, except that TCP_NODELAY stays on: with
+ * Nagle, each transfer ends waiting ~40ms for a delayed ACK, which
+ * would swamp everything else (retr_nodelay_off shows that cost).
+ *
+ * main.c is compiled into this file (with its main() renamed), and the
+ * daemon's other objects linked in, so the code measured is exactly
+ * the daemon's.  Everything logs to /dev/null.
+ */
+
+#ifndef __linux__
+#  error "popbench is Linux only"
+#endif /* __linux__ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stddef.h>
+#include <time.h>
+
+#define main popper_main
+#include "main.c"
+#undef  main
+
+
+#define REPEATS     7
+#define RETR_SIZE   65536       /* bytes in one message */
+#define RETR_CHUNK  4096        /* bytes per write() */
+
+
+/*
+ * Qpopper proper isn't linked in
+ */
+int
+qpopper ( int argc, char *argv[] )
+{
+    return 0;
+}
+
+
+typedef void (*bench_fn) ( long iters );
+
+static int   bench_fd  = -1;
+static int   retr_fd   = -1;       /* server end of the RETR connection */
+static FILE *out       = NULL;     /* results; see main() */
+
+static char  retr_buf [ RETR_CHUNK ];
+
+
+/*
+ * One socket setting for the retr_* benchmarks: its sock_policy field
+ * and the values for "on" and "off"
+ */
+static const struct
+{
+    const char *name;
+    size_t      field;
+    int         on;
+    int         off;
+} retr_opts[] =
+{
+    { "sndbuf",  offsetof ( sock_policy, sndbuf ),        262144, -1 },
+    { "rcvbuf",  offsetof ( sock_policy, rcvbuf ),        262144, -1 },
+    { "nodelay", offsetof ( sock_policy, nodelay ),            1,  0 },
+    { "lowat",   offsetof ( sock_policy, notsent_lowat ),  16384, -1 },
+    { "kalive",  offsetof ( sock_policy, keepalive ),          1,  0 },
+    { "kidle",   offsetof ( sock_policy, keepidle ),          60, -1 },
+    { "kintvl",  offsetof ( sock_policy, keepintvl ),         10, -1 },
+    { "kcnt",    offsetof ( sock_policy, keepcnt ),            5, -1 },
+    { "utmo",    offsetof ( sock_policy, user_timeout ),   30000, -1 },
+};
+
+
+static void
+b_msg ( long iters )
+{
+    long i;
+
+    for ( i = 0; i < iters; i++ )
+        msg ( HERE, "listening on %s:%d", "199.46.50.7", 110 );
+}
+
+
+/*
+ * An error that gets logged.  With no repeat window and the per-second
+ * line count cleared each time, err_msg() never takes the suppressed
+ * path, so this is the full cost of logging one (compare with builds
+ * before err_msg() collapsed repeats).
+ */
+static void
+b_err_msg ( long iters )
+{
+    long i;
+
+    errlog_window = 0;
+    for ( i = 0; i < iters; i++ )
+    {
+        errlog_lines = 0;
+        errno = EMFILE;
+        err_msg ( HERE, "accept() error" );
+    }
+    errlog_window = ERRLOG_WINDOW;
+}
+
+
+/*
+ * The same error over and over, as in an accept() storm: after the
+ * first, each is only counted
+ */
+static void
+b_err_msg_repeat ( long iters )
+{
+    long i;
+
+    errlog_window = ERRLOG_WINDOW;
+    for ( i = 0; i < iters; i++ )
+    {
+        errno = EMFILE;
+        err_msg ( HERE, "accept() error" );
+    }
+    errlog_flush ( TRUE );
+}
+
+
+static void
+b_trace_on ( long iters )
+{
+    long i;
+
+    debug = TRUE;
+    for ( i = 0; i < iters; i++ )
+        TRACE ( trace_file, POP_DEBUG, HERE,
+                "accept=%d; sockfd=%d; clilen=%d; cli_addr=%s:%d\n",
+                7, 3, 16, "10.1.2.3", 49152 );
+    debug = FALSE;
+}
+
+
+static void
+b_trace_off ( long iters )
+{
+    long i;
+
+    debug = FALSE;
+    for ( i = 0; i < iters; i++ )
+    {
+        TRACE ( trace_file, POP_DEBUG, HERE,
+                "accept=%d; sockfd=%d; clilen=%d; cli_addr=%s:%d\n",
+                7, 3, 16, "10.1.2.3", 49152 );
+        __asm__ __volatile__ ( "" ::: "memory" );   /* re-read 'debug' */
+    }
+}
+
+
+static void
+b_sys_err_str ( long iters )
+{
+    long i;
+
+    for ( i = 0; i < iters; i++ )
+    {
+        errno = ( i & 1 ? EAGAIN : 0 );
+        (void) sys_err_str();
+    }
+}
+
+
+static void
+b_parse_addr ( long iters )
+{
+    static const char *specs[] = { "199.46.50.7:8110", "8110", ":110", "10.0.0.1" };
+    unsigned long      addr;
+    unsigned short     port;
+    long               i;
+
+    for ( i = 0; i < iters; i++ )
+    {
+        addr = INADDR_ANY;
+        port = htons ( SERV_TCP_PORT );
+        if ( parse_listen_addr ( specs [ i & 3 ], &addr, &port ) == -1 )
+            abort();
+    }
+}
+
+
+/*
+ * The fcntl()/dup2() sequence motherforker() runs in each child, on a
+ * non-blocking socket as accept() returns it.  The dup() to get a fd
+ * to hand off is included.
+ */
+static void
+b_hand_off ( long iters )
+{
+    int  fd;
+    long i;
+
+    for ( i = 0; i < iters; i++ )
+    {
+        fd = dup ( bench_fd );
+        fcntl ( fd, F_SETFL, fcntl ( fd, F_GETFL, 0 ) | O_NONBLOCK );
+        hand_off_socket ( fd );
+    }
+}
+
+
+/*
+ * One RETR per iteration: read the client's command, then write the
+ * message in RETR_CHUNK pieces, as Qpopper's buffered output does
+ */
+static void
+b_retr ( long iters )
+{
+    char cmd [ 64 ];
+    long i;
+    int  n;
+
+
+    for ( i = 0; i < iters; i++ )
+    {
+        if ( read ( retr_fd, cmd, sizeof(cmd) ) <= 0 )
+            abort();
+        for ( n = 0; n < RETR_SIZE; n += RETR_CHUNK )
+            if ( write ( retr_fd, retr_buf, RETR_CHUNK ) != RETR_CHUNK )
+                abort();
+    }
+}
+
+
+/*
+ * The client side: asks for a message and reads all of it, until the
+ * server closes the connection
+ */
+static void
+retr_client ( int fd )
+{
+    char    buf [ RETR_SIZE ];
+    long    got = 0;
+    ssize_t n   = 0;
+
+
+    for ( ;; )
+    {
+        if ( write ( fd, "RETR 1\r\n", 8 ) != 8 )
+            _exit ( 0 );
+        for ( got = 0; got < RETR_SIZE; got += n )
+        {
+            n = read ( fd, buf, sizeof(buf) );
+            if ( n <= 0 )
+                _exit ( 0 );
+        }
+    }
+}
+
+
+static double
+now_ns ( void )
+{
+    struct timespec ts;
+
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static int
+cmp_double ( const void *a, const void *b )
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return ( x < y ? -1 : x > y ? 1 : 0 );
+}
+
+
+static void
+run ( const char *name, bench_fn fn, long iters )
+{
+    double t [ REPEATS ];
+    double t0;
+    int    r;
+
+    fn ( iters / 10 + 1 );                      /* warm up */
+    for ( r = 0; r < REPEATS; r++ )
+    {
+        t0     = now_ns();
+        fn ( iters );
+        t [ r ] = ( now_ns() - t0 ) / iters;
+    }
+    qsort ( t, REPEATS, sizeof(double), cmp_double );
+
+    fprintf ( out, "%-16s %10.1f ns/op median %10.1f ns/op min %9ld iters\n",
+              name, t [ REPEATS / 2 ], t [ 0 ], iters );
+    fflush  ( out );
+}
+
+
+/*
+ * Runs b_retr over a fresh loopback connection with the given policy
+ * applied to the listening and accepted sockets.  Returns -1 if the
+ * connection can't be set up.
+ */
+static int
+run_retr ( const char *name, sock_policy *pol, long iters )
+{
+    struct sockaddr_in sin;
+    socklen_t          len = sizeof(sin);
+    int                lfd = -1;
+    int                cfd = -1;
+    pid_t              pid = 0;
+
+
+    bzero ( (char *) &sin, sizeof(sin) );
+    sin.sin_family      = AF_INET;
+    sin.sin_addr.s_addr = htonl ( INADDR_LOOPBACK );
+
+    lfd = socket ( AF_INET, SOCK_STREAM, 0 );
+    cfd = socket ( AF_INET, SOCK_STREAM, 0 );
+    if ( lfd == -1 || cfd == -1 )
+        return -1;
+    apply_sock_policy ( lfd, pol, TRUE );
+    if ( bind ( lfd, (struct sockaddr *) &sin, len ) == -1 ||
+         listen ( lfd, 1 ) == -1 ||
+         getsockname ( lfd, (struct sockaddr *) &sin, &len ) == -1 ||
+         connect ( cfd, (struct sockaddr *) &sin, len ) == -1 )
+        return -1;
+    retr_fd = accept ( lfd, NULL, NULL );
+    if ( retr_fd == -1 )
+        return -1;
+    apply_sock_policy ( retr_fd, pol, FALSE );
+    close ( lfd );
+
+    pid = fork();
+    if ( pid == -1 )
+        return -1;
+    if ( pid == 0 )
+    {
+        close ( retr_fd );
+        retr_client ( cfd );
+    }
+    close ( cfd );
+
+    run ( name, b_retr, iters );
+
+    close ( retr_fd );
+    waitpid ( pid, NULL, 0 );
+    return 0;
+}
+
+
+int
+main ( int argc, char *argv[] )
+{
+    long        iters = 200000;
+    int         sv [ 2 ];
+    cpu_set_t   cpus;
+    sock_policy pol;
+    char        name [ 32 ];
+    size_t      i;
+    int         on;
+
+
+    if ( argc == 3 && strcmp ( argv[1], "-n" ) == 0 )
+        iters = atol ( argv[2] );
+    if ( iters <= 0 )
+    {
+        fprintf ( stderr, "usage: %s [-n iterations]\n", argv[0] );
+        return 2;
+    }
+
+    CPU_ZERO ( &cpus );
+    CPU_SET  ( 0, &cpus );
+    sched_setaffinity ( 0, sizeof(cpus), &cpus );
+
+    pname      = "popbench";
+    msg_out    = err_out = fopen ( "/dev/null", "w" );
+    trace_file = fopen ( "/dev/null", "w" );    /* keeps logit() off syslog */
+    if ( msg_out == NULL || trace_file == NULL )
+        return 1;
+
+    /*
+     * hand_off_socket() takes over fds 0-2, so results go to a copy
+     * of stdout made first.
+     */
+    out = fdopen ( dup ( 1 ), "w" );
+    if ( out == NULL || socketpair ( AF_UNIX, SOCK_STREAM, 0, sv ) == -1 )
+        return 1;
+    bench_fd = sv [ 0 ];
+
+    run ( "msg",            b_msg,            iters );
+    run ( "err_msg",        b_err_msg,        iters );
+    run ( "err_msg_repeat", b_err_msg_repeat, iters );
+    run ( "trace_on",       b_trace_on,       iters );
+    run ( "trace_off",      b_trace_off,      iters * 10 );
+    run ( "sys_err_str",    b_sys_err_str,    iters );
+    run ( "parse_addr",     b_parse_addr,     iters );
+    run ( "hand_off",       b_hand_off,       iters );
+
+    memset ( retr_buf, 'x', sizeof(retr_buf) );         /* 80-byte lines */
+    for ( i = 78; i + 1 < sizeof(retr_buf); i += 80 )
+        memcpy ( retr_buf + i, "\r\n", 2 );
+
+    for ( i = 0; i < sizeof(retr_opts) / sizeof(retr_opts[0]); i++ )
+        for ( on = 1; on >= 0; on-- )
+        {
+            memset ( &pol, 0xff, sizeof(pol) );     /* all -1: defaults */
+            pol.nodelay = 1;
+            *(int *) ( (char *) &pol + retr_opts [ i ].field ) =
+                ( on ? retr_opts [ i ].on : retr_opts [ i ].off );
+            snprintf ( name, sizeof(name), "retr_%s_%s",
+                       retr_opts [ i ].name, on ? "on" : "off" );
+            if ( run_retr ( name, &pol, iters / 2000 + 1 ) == -1 )
+                return 1;
+        }
+
+    return 0;
+}
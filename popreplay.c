@@ -0,0 +1,378 @@
+/*
+ * Copyright (c) 2001 QUALCOMM Incorporated.  All rights reserved.
+ * The file license.txt specifies the terms for use, modification,
+ * and redistribution.
+ *
+ * popreplay: drives a server with the connection arrivals recorded in
+ * a standalone daemon's arrival log ($QPOP_ARRIVALS).
+ *
+ *     popreplay [-c factor] [-h ms] [-m max] host port arrival-log
+ *
+ * Connections are opened with the recorded inter-arrival gaps divided
+ * by 'factor' (default 1, i.e., real time).  Each waits for the
+ * greeting, stays open for its recorded session length (also divided
+ * by 'factor'; '-h' gives a fixed hold for sessions with no recorded
+ * length), then sends QUIT.  At most 'max' (default 1000) are open at
+ * once; arrivals beyond that are counted as skipped.
+ *
+ * At the end we print how many connections got a greeting, a "-ERR"
+ * (e.g., server busy), or were closed or refused, and greeting latency
+ * percentiles, so runs against different builds can be compared.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+
+typedef struct
+{
+    double      t;              /* seconds since first arrival */
+    long        dur;            /* session milliseconds, or -1 */
+    int         pid;
+} arrival;
+
+typedef struct
+{
+    int         fd;
+    int         state;
+    double      opened;
+    double      close_at;
+} conn;
+
+#define C_CONNECTING    1
+#define C_GREETING      2
+#define C_HOLDING       3
+
+
+static arrival *arr      = NULL;
+static int      narr     = 0;
+static double  *lat      = NULL;        /* greeting latencies, ms */
+static int      nlat     = 0;
+
+
+static double
+now ( void )
+{
+    struct timespec ts;
+
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * Reads the arrival log, pairing each D record with the most recent
+ * open A record for the same pid.
+ */
+static int
+load ( const char *path )
+{
+    FILE    *fp    = fopen ( path, "r" );
+    char     line  [ 128 ];
+    double   t     = 0;
+    double   t0    = -1;
+    unsigned long h = 0;
+    long     ms    = 0;
+    int      pid   = 0;
+    int     *map   = NULL;      /* pid hash -> arrival index, or -1 */
+    int      msize = 1 << 16;
+    int      maxa  = 0;
+    int      i     = 0;
+
+
+    if ( fp == NULL )
+    {
+        perror ( path );
+        return -1;
+    }
+
+    map = malloc ( msize * sizeof(int) );
+    if ( map == NULL )
+        return -1;
+    for ( i = 0; i < msize; i++ )
+        map [ i ] = -1;
+
+    while ( fgets ( line, sizeof(line), fp ) != NULL )
+    {
+        if ( sscanf ( line, "A %lf %lx %d", &t, &h, &pid ) == 3 )
+        {
+            if ( narr == maxa )
+            {
+                maxa = ( maxa == 0 ? 1024 : maxa * 2 );
+                arr  = realloc ( arr, maxa * sizeof(arrival) );
+                if ( arr == NULL )
+                    return -1;
+            }
+            if ( t0 < 0 )
+                t0 = t;
+            arr [ narr ].t   = t - t0;
+            arr [ narr ].dur = -1;
+            arr [ narr ].pid = pid;
+            if ( pid > 0 )
+                map [ pid & ( msize - 1 ) ] = narr;
+            narr++;
+        }
+        else
+        if ( sscanf ( line, "D %lf %d %ld", &t, &pid, &ms ) == 3 && pid > 0 )
+        {
+            i = map [ pid & ( msize - 1 ) ];
+            if ( i != -1 && arr [ i ].pid == pid && arr [ i ].dur == -1 )
+            {
+                arr [ i ].dur = ms;
+                map [ pid & ( msize - 1 ) ] = -1;
+            }
+        }
+    }
+
+    fclose ( fp );
+    free   ( map );
+    return narr;
+}
+
+
+static int
+cmp_double ( const void *a, const void *b )
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return ( x < y ? -1 : x > y ? 1 : 0 );
+}
+
+
+static double
+pct ( double p )
+{
+    int i = (int) ( p / 100.0 * ( nlat - 1 ) + 0.5 );
+
+    return ( nlat == 0 ? 0 : lat [ i ] );
+}
+
+
+int
+main ( int argc, char *argv[] )
+{
+    double              factor   = 1.0;
+    long                hold     = 0;
+    int                 maxc     = 1000;
+    int                 opt      = 0;
+    struct addrinfo     hints;
+    struct addrinfo    *ai       = NULL;
+    conn               *cs       = NULL;
+    struct pollfd      *pfd      = NULL;
+    int                 nc       = 0;
+    int                 next     = 0;
+    int                 i        = 0;
+    int                 n        = 0;
+    int                 timeout  = 0;
+    double              start    = 0;
+    double              t        = 0;
+    double              wall     = 0;
+    char                buf      [ 512 ];
+    unsigned long       greeted  = 0;
+    unsigned long       errs     = 0;
+    unsigned long       closed   = 0;
+    unsigned long       refused  = 0;
+    unsigned long       skipped  = 0;
+
+
+    while ( ( opt = getopt ( argc, argv, "c:h:m:" ) ) != -1 )
+    {
+        switch ( opt )
+        {
+            case 'c': factor = atof ( optarg ); break;
+            case 'h': hold   = atol ( optarg ); break;
+            case 'm': maxc   = atoi ( optarg ); break;
+            default:  argc   = 0;               break;
+        }
+    }
+
+    if ( argc - optind != 3 || factor <= 0 || maxc <= 0 )
+    {
+        fprintf ( stderr,
+                  "usage: %s [-c factor] [-h ms] [-m max] host port arrival-log\n",
+                  argv[0] );
+        return 2;
+    }
+
+    memset ( &hints, 0, sizeof(hints) );
+    hints.ai_socktype = SOCK_STREAM;
+    if ( getaddrinfo ( argv [ optind ], argv [ optind + 1 ], &hints, &ai ) != 0 )
+    {
+        fprintf ( stderr, "%s: can't resolve %s:%s\n",
+                  argv[0], argv [ optind ], argv [ optind + 1 ] );
+        return 1;
+    }
+
+    if ( load ( argv [ optind + 2 ] ) <= 0 )
+    {
+        fprintf ( stderr, "%s: no arrivals in %s\n", argv[0], argv [ optind + 2 ] );
+        return 1;
+    }
+
+    cs  = calloc ( maxc, sizeof(conn) );
+    pfd = calloc ( maxc, sizeof(struct pollfd) );
+    lat = calloc ( narr, sizeof(double) );
+    if ( cs == NULL || pfd == NULL || lat == NULL )
+        return 1;
+
+    start = now();
+    while ( next < narr || nc > 0 )
+    {
+        t = now() - start;
+
+        /*
+         * Start any connections that are due
+         */
+        while ( next < narr && arr [ next ].t / factor <= t )
+        {
+            if ( nc == maxc )
+            {
+                skipped++;
+                next++;
+                continue;
+            }
+
+            cs [ nc ].fd = socket ( ai->ai_family, SOCK_STREAM, 0 );
+            if ( cs [ nc ].fd == -1 )
+            {
+                refused++;
+                next++;
+                continue;
+            }
+            fcntl ( cs [ nc ].fd, F_SETFL, O_NONBLOCK );
+            if ( connect ( cs [ nc ].fd, ai->ai_addr, ai->ai_addrlen ) == -1 &&
+                 errno != EINPROGRESS )
+            {
+                close ( cs [ nc ].fd );
+                refused++;
+                next++;
+                continue;
+            }
+
+            cs [ nc ].state    = C_CONNECTING;
+            cs [ nc ].opened   = now();
+            cs [ nc ].close_at = ( arr [ next ].dur >= 0
+                                   ? arr [ next ].dur / factor : (double) hold )
+                                 / 1000.0;
+            nc++;
+            next++;
+        }
+
+        /*
+         * Wait for activity, the next arrival, or the next QUIT
+         */
+        timeout = 1000;
+        if ( next < narr )
+        {
+            n = (int) ( ( arr [ next ].t / factor - ( now() - start ) ) * 1000 );
+            if ( n < timeout )
+                timeout = ( n < 0 ? 0 : n );
+        }
+        for ( i = 0; i < nc; i++ )
+        {
+            pfd [ i ].fd     = cs [ i ].fd;
+            pfd [ i ].events = ( cs [ i ].state == C_CONNECTING ? POLLOUT : POLLIN );
+            if ( cs [ i ].state == C_HOLDING )
+            {
+                n = (int) ( ( cs [ i ].close_at - now() ) * 1000 );
+                if ( n < timeout )
+                    timeout = ( n < 0 ? 0 : n );
+            }
+        }
+
+        if ( poll ( pfd, nc, timeout ) == -1 && errno != EINTR )
+        {
+            perror ( "poll" );
+            return 1;
+        }
+
+        for ( i = nc - 1; i >= 0; i-- )
+        {
+            conn *c = &cs [ i ];
+
+            n = 0;
+
+            if ( c->state == C_CONNECTING && pfd [ i ].revents != 0 )
+            {
+                int       err = 0;
+                socklen_t len = sizeof(err);
+
+                getsockopt ( c->fd, SOL_SOCKET, SO_ERROR, &err, &len );
+                if ( err != 0 )
+                {
+                    refused++;
+                    n = 1;
+                }
+                else
+                    c->state = C_GREETING;
+            }
+            else
+            if ( c->state == C_GREETING && pfd [ i ].revents != 0 )
+            {
+                int r = read ( c->fd, buf, sizeof(buf) - 1 );
+
+                if ( r <= 0 )
+                {
+                    closed++;
+                    n = 1;
+                }
+                else
+                if ( strncmp ( buf, "+OK", 3 ) == 0 )
+                {
+                    greeted++;
+                    lat [ nlat++ ] = ( now() - c->opened ) * 1000.0;
+                    c->state    = C_HOLDING;
+                    c->close_at = now() + c->close_at;
+                }
+                else
+                {
+                    errs++;
+                    n = 1;
+                }
+            }
+            else
+            if ( c->state == C_HOLDING &&
+                 ( now() >= c->close_at || pfd [ i ].revents != 0 ) )
+            {
+                if ( write ( c->fd, "QUIT\r\n", 6 ) == -1 )
+                    closed++;
+                n = 1;
+            }
+
+            if ( n )
+            {
+                close ( c->fd );
+                cs [ i ] = cs [ --nc ];
+            }
+        }
+    }
+    wall = now() - start;
+
+    qsort ( lat, nlat, sizeof(double), cmp_double );
+
+    printf ( "arrivals     %d\n",    narr );
+    printf ( "compression  %.2f\n",  factor );
+    printf ( "wall-seconds %.3f\n",  wall );
+    printf ( "greeted      %lu\n",   greeted );
+    printf ( "err-response %lu\n",   errs );
+    printf ( "closed       %lu\n",   closed );
+    printf ( "refused      %lu\n",   refused );
+    printf ( "skipped      %lu\n",   skipped );
+    printf ( "greeting-ms  min %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+             pct ( 0 ), pct ( 50 ), pct ( 90 ), pct ( 99 ), pct ( 100 ) );
+
+    freeaddrinfo ( ai );
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2001 QUALCOMM Incorporated.  All rights reserved.
+ * The file license.txt specifies the terms for use, modification,
+ * and redistribution.
+ *
+ * popstat: prints a snapshot of the standalone daemon's scoreboard.
+ *
+ *     popstat [-a] [scoreboard-file]
+ *
+ * The file defaults to $QPOP_SCOREBOARD.  Only busy slots are shown
+ * unless '-a' is given.  The scoreboard is mapped read-only; the
+ * daemon is never blocked by us.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "scoreboard.h"
+
+
+static const char *state_names[] =
+{
+    "free", "start", "run"
+};
+
+
+/*
+ * Copies a slot, retrying until the copy is consistent.  Gives up
+ * (returns -1) if the writer keeps it busy for too long.
+ */
+static int
+snap_slot ( const sb_slot_t *sp, sb_slot_t *out )
+{
+    unsigned long seq1 = 0;
+    unsigned long seq2 = 0;
+    int           n    = 0;
+
+
+    for ( n = 0; n < 1000; n++ )
+    {
+        seq1 = sp->s.seq;
+        SB_BARRIER();
+        if ( seq1 & 1 )
+            continue;
+        memcpy ( out, (const void *) sp, sizeof(*out) );
+        SB_BARRIER();
+        seq2 = sp->s.seq;
+        if ( seq1 == seq2 )
+            return 0;
+    }
+    return -1;
+}
+
+
+int
+main ( int argc, char *argv[] )
+{
+    const char  *path  = getenv ( "QPOP_SCOREBOARD" );
+    int          all   = 0;
+    int          fd    = -1;
+    int          i     = 0;
+    int          busy  = 0;
+    struct stat  st;
+    void        *map   = NULL;
+    sb_hdr_t    *hdr   = NULL;
+    sb_slot_t    slot;
+    time_t       now   = time ( NULL );
+
+
+    for ( i = 1; i < argc; i++ )
+    {
+        if ( strcmp ( argv[i], "-a" ) == 0 )
+            all = 1;
+        else
+        if ( argv[i][0] == '-' )
+        {
+            fprintf ( stderr, "usage: %s [-a] [scoreboard-file]\n", argv[0] );
+            return 2;
+        }
+        else
+            path = argv[i];
+    }
+
+    if ( path == NULL )
+    {
+        fprintf ( stderr, "%s: no scoreboard file (set QPOP_SCOREBOARD)\n",
+                  argv[0] );
+        return 2;
+    }
+
+    fd = open ( path, O_RDONLY );
+    if ( fd == -1 || fstat ( fd, &st ) == -1 )
+    {
+        perror ( path );
+        return 1;
+    }
+
+    if ( (size_t) st.st_size < SB_HDR_SIZE )
+    {
+        fprintf ( stderr, "%s: not a scoreboard\n", path );
+        return 1;
+    }
+
+    map = mmap ( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close ( fd );
+    if ( map == MAP_FAILED )
+    {
+        perror ( path );
+        return 1;
+    }
+
+    hdr = (sb_hdr_t *) map;
+    if ( hdr->h.magic     != SB_MAGIC     ||
+         hdr->h.version   != SB_VERSION   ||
+         hdr->h.hdr_size  != SB_HDR_SIZE  ||
+         hdr->h.slot_size != SB_SLOT_SIZE ||
+         (size_t) st.st_size < SB_SIZE ( hdr->h.nslots ) )
+    {
+        fprintf ( stderr, "%s: not a scoreboard (or wrong version)\n", path );
+        return 1;
+    }
+
+    printf ( "master pid %ld; up %lds; %d slots\n",
+             hdr->h.master_pid, (long) ( now - hdr->h.started ),
+             hdr->h.nslots );
+    printf ( "fork failures %lu; out of fds %lu; overload pauses %lu; "
+             "access denied %lu\n",
+             hdr->h.fork_failures, hdr->h.fd_exhaustions,
+             hdr->h.overload_pauses, hdr->h.acl_denied );
+    printf ( "error messages suppressed %lu\n", hdr->h.errors_suppressed );
+    printf ( "sessions ended over time limit %lu; by SIGKILL %lu\n",
+             hdr->h.lifetime_kills, hdr->h.forced_kills );
+    printf ( "acceptor restarts %lu\n", hdr->h.acceptor_restarts );
+    if ( hdr->h.nacceptors > 1 && hdr->h.nacceptors <= SB_MAX_ACCEPTORS )
+    {
+        unsigned long total = 0;
+
+        for ( i = 0; i < hdr->h.nacceptors; i++ )
+            total += hdr->h.accepts [ i ];
+        for ( i = 0; i < hdr->h.nacceptors; i++ )
+            printf ( "acceptor %2d: %10lu accepted (%5.1f%%)\n",
+                     i, hdr->h.accepts [ i ],
+                     ( total == 0 ? 0.0 : 100.0 * hdr->h.accepts [ i ] / total ) );
+    }
+    printf ( "%5s %7s %-7s %-20s %6s\n",
+             "slot", "pid", "state", "client", "age" );
+
+    for ( i = 0; i < hdr->h.nslots; i++ )
+    {
+        if ( snap_slot ( SB_SLOT ( hdr, i ), &slot ) == -1 )
+        {
+            printf ( "%5d (busy)\n", i );
+            continue;
+        }
+
+        if ( slot.s.state != SB_FREE )
+            busy++;
+        else
+        if ( all == 0 )
+            continue;
+
+        printf ( "%5d %7ld %-7s %-20.20s %6ld\n",
+                 i, slot.s.pid,
+                 ( slot.s.state >= 0 && slot.s.state <= SB_RUNNING
+                   ? state_names [ slot.s.state ] : "?" ),
+                 slot.s.client,
+                 (long) ( slot.s.state == SB_FREE ? 0 : now - slot.s.started ) );
+    }
+
+    printf ( "%d busy\n", busy );
+    return 0;
+}
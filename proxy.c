@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) 2001 QUALCOMM Incorporated.  All rights reserved.
+ * The file license.txt specifies the terms for use, modification,
+ * and redistribution.
+ *
+ * PROXY protocol v1/v2 for the standalone daemon's listeners behind a
+ * load balancer ("/proxy=1").  See proxy_add().
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/errno.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+#include <sys/socket.h> /* this needs to be after other .h files */
+
+#include "config.h"
+#include "popper.h"
+#include "snprintf.h"
+#include "logit.h"
+#include "scoreboard.h"
+#include "standalone.h"
+#include "proxy.h"
+
+#if HAVE_UNISTD_H
+#  include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_SYS_UNISTD_H
+#  include <sys/unistd.h>
+#endif /* HAVE_SYS_UNISTD_H */
+
+#ifdef HAVE_FCNTL_H
+#  include <fcntl.h>
+#endif /* HAVE_FCNTL_H */
+
+#ifdef HAVE_SYS_FCNTL_H
+#  include <sys/fcntl.h>
+#endif /* HAVE_SYS_FCNTL_H */
+
+
+#ifdef STANDALONE
+
+/*
+ * Globals
+ */
+proxy_conn     *proxy_conns     = NULL; /* waiting for PROXY headers */
+int             nproxy          = 0;
+long            proxy_timeout   = PROXY_TIMEOUT;
+unsigned long   proxy_ok        = 0;
+unsigned long   proxy_local     = 0;    /* LOCAL/UNKNOWN: address kept */
+unsigned long   proxy_bad       = 0;
+unsigned long   proxy_timeouts  = 0;
+unsigned long   proxy_dropped   = 0;    /* too many waiting */
+
+
+/*
+ * PROXY protocol (v1 and v2), for listeners behind a load balancer
+ * such as HAProxy.  The balancer starts each connection with a header
+ * giving the real client's address, which then replaces the
+ * balancer's for access rules, our logging, the scoreboard and the
+ * arrival log (which records when the connection was accepted, not
+ * when its header completed).  It is also set as $QPOP_PEERADDR and
+ * $QPOP_PEERPORT for the session, but Qpopper doesn't read those yet,
+ * so its own log lines still show the balancer's address.
+ *
+ * The master reads headers without blocking: a new connection waits in
+ * proxy_conns, in the select() set, until its header is complete or
+ * $QPOP_PROXY_TIMEOUT milliseconds (default 3000) pass.  Only header
+ * bytes are consumed, so whatever follows is left for Qpopper.  A
+ * connection with a bad header, or none in time, is closed.
+ */
+void
+proxy_add ( int newsockfd, listener *l, struct sockaddr *cli_addr )
+{
+    proxy_conn *pc = NULL;
+    proxy_conn *np = NULL;
+    int         n  = 0;
+
+
+    if ( nproxy == PROXY_MAX_PENDING || newsockfd >= FD_SETSIZE )
+    {
+        proxy_dropped++;
+        TRACE ( trace_file, POP_DEBUG, HERE,
+                "%d connections waiting for PROXY headers; closing fd %d",
+                nproxy, newsockfd );
+        close ( newsockfd );
+        return;
+    }
+
+    if ( proxy_conns == NULL )
+    {
+        np = malloc ( PROXY_MAX_PENDING * sizeof(proxy_conn) );
+        if ( np == NULL )
+        {
+            err_msg ( HERE, "unable to allocate memory" );
+            close ( newsockfd );
+            return;
+        }
+        proxy_conns = np;
+    }
+
+    fcntl ( newsockfd, F_SETFL, O_NONBLOCK | fcntl ( newsockfd, F_GETFL, 0 ) );
+
+    pc = &proxy_conns [ nproxy++ ];
+    pc->fd  = newsockfd;
+    pc->l   = l;
+    pc->len = 0;
+    memcpy ( &pc->addr, cli_addr,
+             ( cli_addr->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6)
+                                               : sizeof(struct sockaddr_in) ) );
+    gettimeofday ( &pc->accepted, NULL );
+    pc->deadline = pc->accepted;
+    n = (int) proxy_timeout;
+    pc->deadline.tv_sec  += n / 1000;
+    pc->deadline.tv_usec += ( n % 1000 ) * 1000;
+    if ( pc->deadline.tv_usec >= 1000000 )
+    {
+        pc->deadline.tv_sec++;
+        pc->deadline.tv_usec -= 1000000;
+    }
+}
+
+
+/*
+ * Parses the first 'len' bytes of a connection as a PROXY header.
+ * Returns 1 if they hold a complete header, setting '*hdrlen' to its
+ * length and 'ss' to the client address (family AF_UNSPEC if the
+ * header doesn't give one, e.g., LOCAL or UNKNOWN); 0 if more bytes
+ * are needed; -1 if this isn't a valid header.
+ */
+int
+proxy_parse ( unsigned char *buf, int len, struct sockaddr_storage *ss,
+              int *hdrlen )
+{
+    static const unsigned char v2sig [ 12 ] =
+        { '\r', '\n', '\r', '\n', '\0', '\r', '\n', 'Q', 'U', 'I', 'T', '\n' };
+    struct sockaddr_in  *sin  = (struct sockaddr_in  *) ss;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) ss;
+    char                 line [ PROXY_V1_MAX + 1 ];
+    char                 proto [ 8 ];
+    char                 src [ 64 ];
+    char                 dst [ 64 ];
+    unsigned int         sport = 0;
+    unsigned int         dport = 0;
+    unsigned char       *eol   = NULL;
+    int                  alen  = 0;
+    int                  n     = 0;
+
+
+    bzero ( (char *) ss, sizeof(*ss) );
+    ss->ss_family = AF_UNSPEC;
+
+    n = ( len < 12 ? len : 12 );
+    if ( memcmp ( buf, v2sig, n ) == 0 )
+    {
+        /*
+         * Version 2: 12-byte signature, version/command, family,
+         * address length, addresses
+         */
+        if ( len < 16 )
+            return 0;
+        if ( ( buf[12] & 0xf0 ) != 0x20 || ( buf[12] & 0x0f ) > 1 )
+            return -1;
+        alen = ( buf[14] << 8 ) | buf[15];
+        if ( 16 + alen > PROXY_HDR_MAX )
+            return -1;
+        if ( len < 16 + alen )
+            return 0;
+        *hdrlen = 16 + alen;
+
+        if ( ( buf[12] & 0x0f ) == 0 )
+            return 1;                           /* LOCAL */
+
+        if ( buf[13] == 0x11 && alen >= 12 )    /* TCP over IPv4 */
+        {
+            sin->sin_family = AF_INET;
+            memcpy ( &sin->sin_addr, buf + 16, 4 );
+            memcpy ( &sin->sin_port, buf + 24, 2 );
+        }
+        else
+        if ( buf[13] == 0x21 && alen >= 36 )    /* TCP over IPv6 */
+        {
+            sin6->sin6_family = AF_INET6;
+            memcpy ( &sin6->sin6_addr, buf + 16, 16 );
+            memcpy ( &sin6->sin6_port, buf + 48, 2 );
+        }
+        return 1;
+    }
+
+    /*
+     * Version 1: "PROXY TCP4|TCP6|UNKNOWN src dst sport dport\r\n"
+     */
+    n = ( len < 6 ? len : 6 );
+    if ( memcmp ( buf, "PROXY ", n ) != 0 )
+        return -1;
+
+    n   = ( len < PROXY_V1_MAX ? len : PROXY_V1_MAX );
+    eol = memchr ( buf, '\n', n );
+    if ( eol == NULL )
+        return ( len < PROXY_V1_MAX ? 0 : -1 );
+    if ( eol == buf || eol[-1] != '\r' )
+        return -1;
+
+    n = (int) ( eol - buf ) - 1;
+    memcpy ( line, buf, n );
+    line [ n ] = '\0';
+    *hdrlen = n + 2;
+
+    *proto = '\0';
+    n = sscanf ( line, "PROXY %7s %63s %63s %u %u", proto, src, dst,
+                 &sport, &dport );
+    if ( strcmp ( proto, "UNKNOWN" ) == 0 )
+        return 1;
+    if ( n != 5 || sport > USHRT_MAX || dport > USHRT_MAX )
+        return -1;
+
+    if ( strcmp ( proto, "TCP4" ) == 0 &&
+         inet_pton ( AF_INET, src, &sin->sin_addr ) == 1 )
+    {
+        sin->sin_family = AF_INET;
+        sin->sin_port   = htons ( (unsigned short) sport );
+        return 1;
+    }
+
+    if ( strcmp ( proto, "TCP6" ) == 0 &&
+         inet_pton ( AF_INET6, src, &sin6->sin6_addr ) == 1 )
+    {
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port   = htons ( (unsigned short) sport );
+        return 1;
+    }
+
+    return -1;
+}
+
+
+/*
+ * Reads what has arrived of connection 'i''s header, and admits the
+ * connection once the header is complete.  We peek at the data, and
+ * only take out bytes that are part of the header.
+ */
+void
+proxy_read ( int i )
+{
+    proxy_conn              *pc     = &proxy_conns [ i ];
+    struct sockaddr_storage  ss;
+    listener                *l      = NULL;
+    int                      fd     = -1;
+    int                      hdrlen = 0;
+    int                      n      = 0;
+    int                      rslt   = 0;
+    struct timeval           accepted;
+    char                     client [ 64 ];
+
+
+    n = recv ( pc->fd, pc->buf + pc->len, PROXY_HDR_MAX - pc->len, MSG_PEEK );
+    if ( n == -1 && ( errno == EAGAIN || errno == EINTR ) )
+        return;
+    if ( n <= 0 )
+    {
+        proxy_drop ( i, &proxy_bad );   /* closed before the header */
+        return;
+    }
+
+    rslt = proxy_parse ( pc->buf, pc->len + n, &ss, &hdrlen );
+    if ( rslt == -1 )
+    {
+        proxy_drop ( i, &proxy_bad );
+        return;
+    }
+
+    /*
+     * Consume what belongs to the header: all of it if it isn't
+     * complete yet, otherwise just up to its end.
+     */
+    if ( rslt == 1 )
+        n = hdrlen - pc->len;
+    if ( read ( pc->fd, pc->buf + pc->len, n ) != n )
+    {
+        proxy_drop ( i, &proxy_bad );
+        return;
+    }
+    pc->len += n;
+
+    if ( rslt == 0 )
+        return;
+
+    if ( ss.ss_family == AF_UNSPEC )
+    {
+        proxy_local++;
+        memcpy ( &ss, &pc->addr, sizeof(ss) );
+    }
+    else
+        proxy_ok++;
+
+    fd       = pc->fd;
+    l        = pc->l;
+    accepted = pc->accepted;
+    proxy_conns [ i ] = proxy_conns [ --nproxy ];
+
+    TRACE ( trace_file, POP_DEBUG, HERE, "PROXY header (%d bytes) on fd %d: %s",
+            hdrlen, fd,
+            addr_str ( (struct sockaddr *) &ss, client, sizeof(client), TRUE ) );
+
+    admit ( fd, l, (struct sockaddr *) &ss, &accepted );
+}
+
+
+/*
+ * Closes waiting connection 'i', counting it in '*counter'
+ */
+void
+proxy_drop ( int i, unsigned long *counter )
+{
+    TRACE ( trace_file, POP_DEBUG, HERE, "no valid PROXY header; closing fd %d",
+            proxy_conns [ i ].fd );
+    (*counter)++;
+    close ( proxy_conns [ i ].fd );
+    proxy_conns [ i ] = proxy_conns [ --nproxy ];
+}
+
+
+/*
+ * Reads from waiting connections that select() says are ready, and
+ * drops those past their deadline.
+ */
+void
+proxy_poll ( fd_set *fds )
+{
+    struct timeval now;
+    int            i = 0;
+
+
+    gettimeofday ( &now, NULL );
+    for ( i = nproxy - 1; i >= 0; i-- )
+    {
+        if ( FD_ISSET ( proxy_conns [ i ].fd, fds ) )
+            proxy_read ( i );
+        else
+        if ( timercmp ( &now, &proxy_conns [ i ].deadline, > ) )
+            proxy_drop ( i, &proxy_timeouts );
+    }
+}
+
+
+/*
+ * If connections are waiting, returns 'tv' set to the time until the
+ * first deadline; otherwise NULL.
+ */
+struct timeval *
+proxy_wait ( struct timeval *tv )
+{
+    struct timeval now;
+    struct timeval first;
+    int            i = 0;
+
+
+    if ( nproxy == 0 )
+        return NULL;
+
+    first = proxy_conns [ 0 ].deadline;
+    for ( i = 1; i < nproxy; i++ )
+        if ( timercmp ( &proxy_conns [ i ].deadline, &first, < ) )
+            first = proxy_conns [ i ].deadline;
+
+    gettimeofday ( &now, NULL );
+    if ( timercmp ( &first, &now, < ) )
+        first = now;
+    timersub ( &first, &now, tv );
+    return tv;
+}
+
+
+/*
+ * Closes all waiting connections (in a child)
+ */
+void
+proxy_close_all ( void )
+{
+    while ( nproxy > 0 )
+        close ( proxy_conns [ --nproxy ].fd );
+}
+
+
+/*
+ * Logs the PROXY counters, if any listener uses it
+ */
+void
+proxy_report ( void )
+{
+    if ( proxy_conns == NULL )
+        return;
+
+    msg ( HERE, "proxy: %lu headers, %lu without an address, %lu bad, "
+                "%lu timed out, %lu dropped; %d waiting",
+          proxy_ok, proxy_local, proxy_bad, proxy_timeouts, proxy_dropped,
+          nproxy );
+}
+
+#endif /* STANDALONE */
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2001 QUALCOMM Incorporated.  All rights reserved.
+ * The file license.txt specifies the terms for use, modification,
+ * and redistribution.
+ *
+ * PROXY protocol v1/v2 for the standalone daemon's listeners behind a
+ * load balancer ("/proxy=1").  See proxy_add().
+ */
+
+#ifndef _PROXY_H
+#define _PROXY_H
+
+/*
+ * Connection waiting for its PROXY protocol header (see proxy_read())
+ */
+#define PROXY_HDR_MAX         232   /* v2: 16 + longest address block */
+#define PROXY_V1_MAX          107
+#define PROXY_MAX_PENDING     256
+#define PROXY_TIMEOUT        3000   /* milliseconds */
+
+typedef struct
+{
+    int                     fd;
+    listener               *l;
+    struct sockaddr_storage addr;   /* the balancer's, until replaced */
+    struct timeval          accepted;
+    struct timeval          deadline;
+    int                     len;    /* header bytes read so far */
+    unsigned char           buf [ PROXY_HDR_MAX ];
+} proxy_conn;
+
+
+extern proxy_conn  *proxy_conns;
+extern int          nproxy;
+extern long         proxy_timeout;
+
+void    proxy_add    ( int newsockfd, listener *l, struct sockaddr *cli_addr );
+int     proxy_parse  ( unsigned char *buf, int len, struct sockaddr_storage *ss,
+                       int *hdrlen );
+void    proxy_read   ( int i );
+void    proxy_drop   ( int i, unsigned long *counter );
+void    proxy_poll   ( fd_set *fds );
+struct timeval *proxy_wait ( struct timeval *tv );
+void    proxy_close_all ( void );
+void    proxy_report ( void );
+
+#endif /* _PROXY_H */
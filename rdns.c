@@ -0,0 +1,517 @@
+/*
+ * Copyright (c) 2001 QUALCOMM Incorporated.  All rights reserved.
+ * The file license.txt specifies the terms for use, modification,
+ * and redistribution.
+ *
+ * Asynchronous reverse DNS for the standalone daemon ($QPOP_RDNS_CACHE):
+ * a resolver helper process and an LRU cache.  See rdns_helper().
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <sys/socket.h> /* this needs to be after other .h files */
+
+#include "config.h"
+#include "popper.h"
+#include "snprintf.h"
+#include "logit.h"
+#include "scoreboard.h"
+#include "standalone.h"
+#include "rdns.h"
+#include "acl.h"
+#include "proxy.h"
+
+#if HAVE_UNISTD_H
+#  include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_SYS_UNISTD_H
+#  include <sys/unistd.h>
+#endif /* HAVE_SYS_UNISTD_H */
+
+#ifdef HAVE_FCNTL_H
+#  include <fcntl.h>
+#endif /* HAVE_FCNTL_H */
+
+#ifdef HAVE_SYS_FCNTL_H
+#  include <sys/fcntl.h>
+#endif /* HAVE_SYS_FCNTL_H */
+
+
+#ifdef STANDALONE
+
+/*
+ * Globals
+ */
+rdns_entry     *rdns_cache      = NULL; /* reverse DNS cache */
+int            *rdns_buckets    = NULL;
+int             rdns_nbuckets   = 0;
+int             rdns_max        = 0;
+int             rdns_head       = -1;   /* most recently used */
+int             rdns_tail       = -1;   /* least recently used */
+long            rdns_ttl        = 0;
+long            rdns_neg_ttl    = 0;
+long            rdns_wait       = 0;    /* ms a miss may wait for an answer */
+int             rdns_fd         = -1;   /* to the resolver helper */
+pid_t           rdns_pid        = 0;
+unsigned long   rdns_hits       = 0;
+unsigned long   rdns_misses     = 0;
+unsigned long   rdns_resolved   = 0;
+unsigned long   rdns_failed     = 0;
+unsigned long   rdns_dropped    = 0;
+unsigned long   rdns_answered   = 0;    /* misses answered within rdns_wait */
+
+
+/*
+ * Reverse DNS for client addresses, done by the master so the session
+ * child need not block on the resolver.
+ *
+ * Lookups run in a helper process (one per acceptor) that we talk to
+ * over a socketpair, so the accept loop never waits for DNS.  Results
+ * are kept in a bounded LRU cache with a TTL ($QPOP_RDNS_TTL seconds;
+ * failures for $QPOP_RDNS_NEG_TTL).  For an address not in the cache a
+ * lookup is started, and the connection waits at most $QPOP_RDNS_WAIT
+ * milliseconds (default 50) for the answer; if none comes it is served
+ * without a name, and the client's next connection hits.  The wait
+ * holds up the accept loop, so keep it short (0 turns it off).  A name
+ * is only cached if it resolves back to the address.
+ *
+ * The name is set as $QPOP_PEERNAME in the session child, but Qpopper
+ * doesn't read it yet and still does its own lookup, so for now this
+ * only saves the lookup for other consumers (a wrapper, say).
+ *
+ * The helper uses the system resolver, so it can be tested against a
+ * stub resolver named in resolv.conf, or against /etc/hosts.
+ */
+void
+rdns_helper ( int fd )
+{
+    rdns_msg                req;
+    rdns_msg                rsp;
+    struct sockaddr_storage ss;
+    struct sockaddr_in     *sin  = (struct sockaddr_in  *) &ss;
+    struct sockaddr_in6    *sin6 = (struct sockaddr_in6 *) &ss;
+    struct addrinfo         hints;
+    struct addrinfo        *ai   = NULL;
+    struct addrinfo        *ap   = NULL;
+    unsigned char           key [ 16 ];
+    socklen_t               slen = 0;
+    int                     n    = 0;
+
+
+    while ( TRUE )
+    {
+        n = recv ( fd, &req, sizeof(req), 0 );
+        if ( n == -1 && errno == EINTR )
+            continue;
+        if ( n <= 0 )
+            break;      /* master went away */
+        if ( n != sizeof(req) )
+            continue;
+
+        memset ( &ss, 0, sizeof(ss) );
+        if ( req.len == 4 )
+        {
+            sin->sin_family = AF_INET;
+            memcpy ( &sin->sin_addr, req.key, 4 );
+            slen = sizeof(*sin);
+        }
+        else
+        {
+            sin6->sin6_family = AF_INET6;
+            memcpy ( &sin6->sin6_addr, req.key, 16 );
+            slen = sizeof(*sin6);
+        }
+
+        rsp        = req;
+        rsp.ok     = FALSE;
+        rsp.name[0] = '\0';
+
+        if ( getnameinfo ( (struct sockaddr *) &ss, slen,
+                           rsp.name, sizeof(rsp.name), NULL, 0,
+                           NI_NAMEREQD ) == 0 )
+        {
+            /*
+             * Only believe the name if it maps back to the address
+             */
+            memset ( &hints, 0, sizeof(hints) );
+            hints.ai_family   = ss.ss_family;
+            hints.ai_socktype = SOCK_STREAM;
+            if ( getaddrinfo ( rsp.name, NULL, &hints, &ai ) == 0 )
+            {
+                for ( ap = ai; ap != NULL && rsp.ok == FALSE; ap = ap->ai_next )
+                    if ( addr_key ( ap->ai_addr, key ) == req.len &&
+                         memcmp ( key, req.key, req.len ) == 0 )
+                        rsp.ok = TRUE;
+                freeaddrinfo ( ai );
+            }
+        }
+
+        if ( rsp.ok == FALSE )
+            rsp.name[0] = '\0';
+        if ( send ( fd, &rsp, sizeof(rsp), 0 ) == -1 )
+            break;
+    }
+
+    _exit ( 0 );
+}
+
+
+/*
+ * Starts the resolver helper.  Returns 0, or -1 if it couldn't.
+ */
+int
+rdns_start ( void )
+{
+    int   sv [ 2 ];
+    pid_t pid = 0;
+
+
+    if ( socketpair ( AF_UNIX, SOCK_SEQPACKET, 0, sv ) == -1 )
+    {
+        err_msg ( HERE, "Unable to create resolver socket pair" );
+        return -1;
+    }
+
+    pid = fork();
+    if ( pid == -1 )
+    {
+        err_msg ( HERE, "Unable to start resolver" );
+        close ( sv [ 0 ] );
+        close ( sv [ 1 ] );
+        return -1;
+    }
+
+    if ( pid == 0 )
+    { /* I'm the helper */
+        signal ( SIGCHLD, SIG_DFL );
+        signal ( SIGTERM, SIG_DFL );
+        signal ( SIGHUP,  SIG_IGN );
+        close  ( sv [ 0 ] );
+        close_listeners();
+        if ( reserve_fd != -1 )
+            close ( reserve_fd );
+        proxy_close_all();
+        if ( arrival_fd != -1 )
+            close ( arrival_fd );
+        rdns_helper ( sv [ 1 ] );
+    }
+
+    close ( sv [ 1 ] );
+    fcntl ( sv [ 0 ], F_SETFL, O_NONBLOCK | fcntl ( sv [ 0 ], F_GETFL, 0 ) );
+    rdns_fd  = sv [ 0 ];
+    rdns_pid = pid;
+    TRACE ( trace_file, POP_DEBUG, HERE, "started resolver; pid=%d; fd=%d",
+            (int) pid, rdns_fd );
+    return 0;
+}
+
+
+/*
+ * Allocates the cache, and starts the helper, if $QPOP_RDNS_CACHE
+ * asks for a cache.
+ */
+void
+rdns_init ( void )
+{
+    int i = 0;
+
+
+    rdns_max = (int) env_long ( "QPOP_RDNS_CACHE", 0 );
+    if ( rdns_max <= 0 )
+        return;
+
+    rdns_ttl     = env_long ( "QPOP_RDNS_TTL",     300 );
+    rdns_neg_ttl = env_long ( "QPOP_RDNS_NEG_TTL",  60 );
+    rdns_wait    = env_long ( "QPOP_RDNS_WAIT",     50 );
+    if ( rdns_wait < 0 )
+        err_dump ( HERE, "QPOP_RDNS_WAIT must not be negative" );
+
+    for ( rdns_nbuckets = 16; rdns_nbuckets < rdns_max; rdns_nbuckets *= 2 )
+        ;
+
+    rdns_cache   = calloc ( rdns_max, sizeof(rdns_entry) );
+    rdns_buckets = malloc ( rdns_nbuckets * sizeof(int) );
+    if ( rdns_cache == NULL || rdns_buckets == NULL )
+        err_dump ( HERE, "unable to allocate memory" );
+
+    for ( i = 0; i < rdns_nbuckets; i++ )
+        rdns_buckets [ i ] = -1;
+
+    /*
+     * All entries start on the free list, which is the LRU tail
+     */
+    for ( i = 0; i < rdns_max; i++ )
+    {
+        rdns_cache [ i ].state = RDNS_FREE;
+        rdns_cache [ i ].hnext = -1;
+        rdns_cache [ i ].prev  = i - 1;
+        rdns_cache [ i ].next  = ( i + 1 < rdns_max ? i + 1 : -1 );
+    }
+    rdns_head = 0;
+    rdns_tail = rdns_max - 1;
+
+    rdns_start();
+}
+
+
+static unsigned int
+rdns_hash ( const unsigned char *key, int len )
+{
+    unsigned int h = 2166136261U;
+    int          i = 0;
+
+    for ( i = 0; i < len; i++ )
+        h = ( h ^ key [ i ] ) * 16777619U;
+    return h & ( rdns_nbuckets - 1 );
+}
+
+
+/*
+ * Moves entry 'i' to the most-recently-used end of the list
+ */
+static void
+rdns_touch ( int i )
+{
+    rdns_entry *e = &rdns_cache [ i ];
+
+    if ( rdns_head == i )
+        return;
+
+    /* unlink */
+    rdns_cache [ e->prev ].next = e->next;
+    if ( e->next != -1 )
+        rdns_cache [ e->next ].prev = e->prev;
+    else
+        rdns_tail = e->prev;
+
+    /* push on head */
+    e->prev = -1;
+    e->next = rdns_head;
+    rdns_cache [ rdns_head ].prev = i;
+    rdns_head = i;
+}
+
+
+static int
+rdns_find ( const unsigned char *key, int len )
+{
+    int i = rdns_buckets [ rdns_hash ( key, len ) ];
+
+    while ( i != -1 &&
+            ( rdns_cache [ i ].len != len ||
+              memcmp ( rdns_cache [ i ].key, key, len ) != 0 ) )
+        i = rdns_cache [ i ].hnext;
+    return i;
+}
+
+
+/*
+ * Takes the least recently used entry, unhashes it, and sets it up
+ * for 'key'.
+ */
+static int
+rdns_take ( const unsigned char *key, int len )
+{
+    int          i = rdns_tail;
+    int         *p = NULL;
+    unsigned int h = 0;
+
+
+    if ( rdns_cache [ i ].state != RDNS_FREE )
+    {
+        h = rdns_hash ( rdns_cache [ i ].key, rdns_cache [ i ].len );
+        for ( p = &rdns_buckets [ h ]; *p != i; p = &rdns_cache [ *p ].hnext )
+            ;
+        *p = rdns_cache [ i ].hnext;
+    }
+
+    h = rdns_hash ( key, len );
+    rdns_cache [ i ].hnext = rdns_buckets [ h ];
+    rdns_buckets [ h ]     = i;
+    rdns_cache [ i ].len   = len;
+    memcpy ( rdns_cache [ i ].key, key, len );
+    rdns_touch ( i );
+    return i;
+}
+
+
+/*
+ * Waits up to rdns_wait ms for the helper to answer for pending entry
+ * 'i', collecting any other answers meanwhile.  Returns the name, or
+ * NULL if there is none (yet).
+ */
+static char *
+rdns_await ( int i )
+{
+    rdns_entry     *e = &rdns_cache [ i ];
+    struct timeval  now;
+    struct timeval  end;
+    struct timeval  tv;
+    fd_set          fds;
+
+
+    gettimeofday ( &now, NULL );
+    tv.tv_sec  = rdns_wait / 1000;
+    tv.tv_usec = ( rdns_wait % 1000 ) * 1000;
+    timeradd ( &now, &tv, &end );
+
+    while ( e->state == RDNS_PENDING && rdns_fd != -1 &&
+            timercmp ( &now, &end, < ) )
+    {
+        timersub ( &end, &now, &tv );
+        FD_ZERO ( &fds );
+        FD_SET  ( rdns_fd, &fds );
+        if ( select ( rdns_fd + 1, &fds, NULL, NULL, &tv ) > 0 )
+            rdns_reply();
+        gettimeofday ( &now, NULL );
+    }
+
+    if ( e->state == RDNS_PENDING )
+        return NULL;
+    rdns_answered++;
+    return ( e->state == RDNS_OK ? e->name : NULL );
+}
+
+
+/*
+ * Returns the name of the client, or NULL.  On a miss, starts a
+ * lookup and waits briefly for it (see rdns_await()).
+ */
+char *
+rdns_lookup ( struct sockaddr *sa )
+{
+    static time_t   last_start = 0;
+    unsigned char   key [ 16 ];
+    rdns_entry     *e   = NULL;
+    rdns_msg        req;
+    time_t          now = 0;
+    int             len = 0;
+    int             i   = 0;
+
+
+    if ( rdns_cache == NULL )
+        return NULL;
+
+    len = addr_key ( sa, key );
+    if ( len == -1 )
+        return NULL;
+
+    now = time ( NULL );
+    i   = rdns_find ( key, len );
+    if ( i != -1 && now < rdns_cache [ i ].expires )
+    {
+        e = &rdns_cache [ i ];
+        rdns_touch ( i );
+        if ( e->state == RDNS_PENDING )
+        {
+            rdns_misses++;
+            return rdns_await ( i );
+        }
+        rdns_hits++;
+        return ( e->state == RDNS_OK ? e->name : NULL );
+    }
+
+    rdns_misses++;
+
+    if ( rdns_fd == -1 )
+    {
+        /*
+         * Restart a dead helper, but not in a tight loop
+         */
+        if ( now - last_start < 10 )
+            return NULL;
+        last_start = now;
+        if ( rdns_start() == -1 )
+            return NULL;
+    }
+
+    if ( i == -1 )
+        i = rdns_take ( key, len );
+    e          = &rdns_cache [ i ];
+    e->state   = RDNS_PENDING;
+    e->expires = now + 10;      /* give up waiting after this */
+
+    memset ( &req, 0, sizeof(req) );
+    req.len = len;
+    memcpy ( req.key, key, len );
+    if ( send ( rdns_fd, &req, sizeof(req), 0 ) == -1 )
+    {
+        rdns_dropped++;
+        e->expires = 0;
+        return NULL;
+    }
+
+    return rdns_await ( i );
+}
+
+
+/*
+ * Collects answers from the helper
+ */
+void
+rdns_reply ( void )
+{
+    rdns_msg    rsp;
+    rdns_entry *e = NULL;
+    int         n = 0;
+    int         i = 0;
+
+
+    while ( ( n = recv ( rdns_fd, &rsp, sizeof(rsp), 0 ) ) == sizeof(rsp) )
+    {
+        i = rdns_find ( rsp.key, rsp.len );
+        if ( i == -1 )
+            continue;   /* evicted meanwhile */
+
+        e = &rdns_cache [ i ];
+        if ( rsp.ok )
+        {
+            rdns_resolved++;
+            e->state   = RDNS_OK;
+            e->expires = time ( NULL ) + rdns_ttl;
+            strcpy ( e->name, rsp.name );
+        }
+        else
+        {
+            rdns_failed++;
+            e->state   = RDNS_FAIL;
+            e->expires = time ( NULL ) + rdns_neg_ttl;
+        }
+        TRACE ( trace_file, POP_DEBUG, HERE, "resolver: %s",
+                ( rsp.ok ? rsp.name : "(no name)" ) );
+    }
+
+    if ( n == 0 || ( n == -1 && errno != EAGAIN && errno != EINTR ) )
+    {
+        msg ( HERE, "resolver went away; will restart" );
+        close ( rdns_fd );
+        rdns_fd = -1;
+    }
+}
+
+
+/*
+ * Logs the cache counters
+ */
+void
+rdns_report ( void )
+{
+    if ( rdns_cache == NULL )
+        return;
+
+    msg ( HERE, "rdns cache: %lu hits, %lu misses (%lu answered in time), "
+                "%lu resolved, %lu failed, %lu dropped",
+          rdns_hits, rdns_misses, rdns_answered, rdns_resolved, rdns_failed,
+          rdns_dropped );
+}
+
+#endif /* STANDALONE */
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2001 QUALCOMM Incorporated.  All rights reserved.
+ * The file license.txt specifies the terms for use, modification,
+ * and redistribution.
+ *
+ * Asynchronous reverse DNS for the standalone daemon ($QPOP_RDNS_CACHE):
+ * a resolver helper process and an LRU cache.  See rdns_helper().
+ */
+
+#ifndef _RDNS_H
+#define _RDNS_H
+
+/*
+ * Reverse DNS cache entry, and request/answer exchanged with the
+ * resolver helper (see rdns_init()).  Entries are linked into an LRU
+ * list and hash chains by index.
+ */
+#define RDNS_FREE       0
+#define RDNS_PENDING    1
+#define RDNS_OK         2
+#define RDNS_FAIL       3
+
+#define RDNS_NAME_LEN   256
+
+typedef struct
+{
+    int             state;
+    int             len;            /* key length: 4 or 16 */
+    unsigned char   key [ 16 ];
+    time_t          expires;
+    int             prev;           /* LRU list */
+    int             next;
+    int             hnext;          /* hash chain */
+    char            name [ RDNS_NAME_LEN ];
+} rdns_entry;
+
+typedef struct
+{
+    int             len;
+    unsigned char   key [ 16 ];
+    BOOL            ok;
+    char            name [ RDNS_NAME_LEN ];
+} rdns_msg;
+
+
+extern int          rdns_fd;
+
+void    rdns_helper  ( int fd );
+int     rdns_start   ( void );
+void    rdns_init    ( void );
+char   *rdns_lookup  ( struct sockaddr *sa );
+void    rdns_reply   ( void );
+void    rdns_report  ( void );
+
+#endif /* _RDNS_H */
@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2001 QUALCOMM Incorporated.  All rights reserved.
+ * The file license.txt specifies the terms for use, modification,
+ * and redistribution.
+ *
+ * Scheduling classes for the standalone daemon's session children
+ * ($QPOP_CLASSES).  See class_load().
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/errno.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sched.h>
+#ifdef __linux__
+#  include <sys/syscall.h>
+#endif /* __linux__ */
+#include <sys/socket.h> /* this needs to be after other .h files */
+
+#include "config.h"
+#include "popper.h"
+#include "snprintf.h"
+#include "logit.h"
+#include "scoreboard.h"
+#include "standalone.h"
+#include "sched_class.h"
+
+#if HAVE_UNISTD_H
+#  include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_SYS_UNISTD_H
+#  include <sys/unistd.h>
+#endif /* HAVE_SYS_UNISTD_H */
+
+#ifdef HAVE_FCNTL_H
+#  include <fcntl.h>
+#endif /* HAVE_FCNTL_H */
+
+#ifdef HAVE_SYS_FCNTL_H
+#  include <sys/fcntl.h>
+#endif /* HAVE_SYS_FCNTL_H */
+
+
+#ifdef STANDALONE
+
+/*
+ * Globals
+ */
+sched_class     classes       [ MAX_CLASSES ];
+int             nclasses        = 0;
+
+
+/*
+ * Reads the scheduling classes for session children from
+ * $QPOP_CLASSES, e.g.,
+ *
+ *     bulk:nice=10,io=idle,batch;interactive:nice=-5,io=be/0
+ *
+ * Each class is a name, a ':', and a list of
+ *
+ *     nice=N       setpriority() value, -20 to 19
+ *     io=C[/N]     I/O priority class rt, be or idle, and level 0
+ *                  (highest) to 7; Linux only
+ *     batch        SCHED_BATCH; Linux only
+ *
+ * A listener picks a class with ".../class=bulk", and an access rule
+ * with "allow 10.0.0.0/8 class=bulk"; the client's rule wins.  Class 0,
+ * "default", leaves the child as the master is.  Errors are fatal.
+ */
+void
+class_load ( void )
+{
+    sched_class *c    = NULL;
+    char        *spec = getenv ( "QPOP_CLASSES" );
+    char        *buf  = NULL;
+    char        *next = NULL;
+    char        *opt  = NULL;
+    char        *nopt = NULL;
+    char        *ptr  = NULL;
+    char        *end  = NULL;
+    long         n    = 0;
+
+
+    bzero ( (char *) classes, sizeof(classes) );
+    strcpy ( classes [ 0 ].name, "default" );
+    classes [ 0 ].nice = CLASS_NO_NICE;
+    nclasses = 1;
+
+    if ( spec == NULL || *spec == '\0' )
+        return;
+
+    buf = strdup ( spec );
+    if ( buf == NULL )
+        err_dump ( HERE, "unable to allocate memory" );
+
+    for ( ptr = buf; ptr != NULL && *ptr != '\0'; ptr = next )
+    {
+        next = strchr ( ptr, ';' );
+        if ( next != NULL )
+            *next++ = '\0';
+
+        opt = strchr ( ptr, ':' );
+        if ( opt != NULL )
+            *opt++ = '\0';
+        if ( *ptr == '\0' || strlen ( ptr ) >= sizeof(c->name) ||
+             class_find ( ptr ) != -1 )
+            err_dump ( HERE, "QPOP_CLASSES: bad or repeated class name \"%s\"",
+                       ptr );
+        if ( nclasses == MAX_CLASSES )
+            err_dump ( HERE, "QPOP_CLASSES: at most %d classes allowed",
+                       MAX_CLASSES - 1 );
+
+        c = &classes [ nclasses++ ];
+        strcpy ( c->name, ptr );
+        c->nice = CLASS_NO_NICE;
+
+        for ( ; opt != NULL && *opt != '\0'; opt = nopt )
+        {
+            nopt = strchr ( opt, ',' );
+            if ( nopt != NULL )
+                *nopt++ = '\0';
+
+            if ( strncmp ( opt, "nice=", 5 ) == 0 )
+            {
+                n = strtol ( opt + 5, &end, 10 );
+                if ( end == opt + 5 || *end != '\0' || n < -20 || n > 19 )
+                    err_dump ( HERE, "QPOP_CLASSES: bad \"%s\" for class %s",
+                               opt, c->name );
+                c->nice = (int) n;
+            }
+            else
+            if ( strncmp ( opt, "io=", 3 ) == 0 )
+            {
+                end = strchr ( opt + 3, '/' );
+                c->iolevel = 4;
+                if ( end != NULL )
+                {
+                    *end++ = '\0';
+                    c->iolevel = ( *end >= '0' && *end <= '7' && end[1] == '\0'
+                                   ? *end - '0' : -1 );
+                }
+                if ( strcmp ( opt + 3, "rt" ) == 0 )
+                    c->ioclass = IOPRIO_CLASS_RT;
+                else
+                if ( strcmp ( opt + 3, "be" ) == 0 )
+                    c->ioclass = IOPRIO_CLASS_BE;
+                else
+                if ( strcmp ( opt + 3, "idle" ) == 0 )
+                {
+                    c->ioclass = IOPRIO_CLASS_IDLE;
+                    c->iolevel = 0;
+                }
+                if ( c->ioclass == 0 || c->iolevel == -1 )
+                    err_dump ( HERE, "QPOP_CLASSES: bad io setting for class %s",
+                               c->name );
+            }
+            else
+            if ( strcmp ( opt, "batch" ) == 0 )
+                c->batch = TRUE;
+            else
+                err_dump ( HERE, "QPOP_CLASSES: unknown setting \"%s\" for class %s",
+                           opt, c->name );
+        }
+
+#if !defined(__linux__) || !defined(SYS_ioprio_set)
+        if ( c->ioclass != 0 )
+            msg ( HERE, "class %s: io not supported on this platform; ignored",
+                  c->name );
+#endif /* !__linux__ || !SYS_ioprio_set */
+#ifndef   SCHED_BATCH
+        if ( c->batch )
+            msg ( HERE, "class %s: batch not supported on this platform; ignored",
+                  c->name );
+#endif /* SCHED_BATCH */
+    }
+
+    free ( buf );
+}
+
+
+/*
+ * Returns the index of the class called 'name', or -1
+ */
+int
+class_find ( const char *name )
+{
+    int i = 0;
+
+
+    for ( i = 0; i < nclasses; i++ )
+        if ( strcmp ( classes [ i ].name, name ) == 0 )
+            return i;
+    return -1;
+}
+
+
+/*
+ * Run in a session child before Qpopper: puts us in class 'cls'.
+ * Failures are logged; the session goes on regardless.
+ */
+void
+class_apply ( int cls )
+{
+    sched_class        *c = &classes [ cls ];
+#ifdef    SCHED_BATCH
+    struct sched_param  sp;
+#endif /* SCHED_BATCH */
+
+
+    if ( cls <= 0 )
+        return;
+
+    if ( c->nice != CLASS_NO_NICE &&
+         setpriority ( PRIO_PROCESS, 0, c->nice ) == -1 )
+        err_msg ( HERE, "class %s: unable to set nice %d", c->name, c->nice );
+
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    if ( c->ioclass != 0 &&
+         syscall ( SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                   ( c->ioclass << IOPRIO_CLASS_SHIFT ) | c->iolevel ) == -1 )
+        err_msg ( HERE, "class %s: unable to set I/O priority", c->name );
+#endif /* __linux__ && SYS_ioprio_set */
+
+#ifdef    SCHED_BATCH
+    if ( c->batch )
+    {
+        bzero ( (char *) &sp, sizeof(sp) );
+        if ( sched_setscheduler ( 0, SCHED_BATCH, &sp ) == -1 )
+            err_msg ( HERE, "class %s: unable to set SCHED_BATCH", c->name );
+    }
+#endif /* SCHED_BATCH */
+
+    TRACE ( trace_file, POP_DEBUG, HERE, "session in class %s", c->name );
+}
+
+
+/*
+ * Accounts for a reaped session of class 'cls'
+ */
+void
+class_done ( int cls, struct rusage *ru, struct timeval *start )
+{
+    sched_class    *c = &classes [ cls ];
+    struct timeval  now;
+
+
+    gettimeofday ( &now, NULL );
+    c->sessions++;
+    c->cpu_ms  += ( ru->ru_utime.tv_sec  + ru->ru_stime.tv_sec  ) * 1000 +
+                  ( ru->ru_utime.tv_usec + ru->ru_stime.tv_usec ) / 1000;
+    c->wall_ms += ( now.tv_sec  - start->tv_sec  ) * 1000 +
+                  ( now.tv_usec - start->tv_usec ) / 1000;
+}
+
+
+/*
+ * Logs each class's counters (if there are classes)
+ */
+void
+class_report ( void )
+{
+    sched_class *c = NULL;
+    int          i = 0;
+
+
+    if ( nclasses < 2 )
+        return;
+
+    for ( i = 0; i < nclasses; i++ )
+    {
+        c = &classes [ i ];
+        msg ( HERE, "class %s: %d active, %lu ended; %lu ms cpu, "
+                    "%lu ms mean session",
+              c->name, c->active, c->sessions, c->cpu_ms,
+              ( c->sessions == 0 ? 0 : c->wall_ms / c->sessions ) );
+    }
+}
+
+#endif /* STANDALONE */
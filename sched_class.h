@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2001 QUALCOMM Incorporated.  All rights reserved.
+ * The file license.txt specifies the terms for use, modification,
+ * and redistribution.
+ *
+ * Scheduling classes for the standalone daemon's session children
+ * ($QPOP_CLASSES).  See class_load().
+ */
+
+#ifndef _SCHED_CLASS_H
+#define _SCHED_CLASS_H
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/*
+ * Scheduling class for session children (see class_load())
+ */
+#define MAX_CLASSES            16
+#define CLASS_NO_NICE          99
+
+#ifndef   IOPRIO_CLASS_SHIFT
+#  define IOPRIO_CLASS_RT       1
+#  define IOPRIO_CLASS_BE       2
+#  define IOPRIO_CLASS_IDLE     3
+#  define IOPRIO_CLASS_SHIFT   13
+#  define IOPRIO_WHO_PROCESS    1
+#endif /* IOPRIO_CLASS_SHIFT */
+
+#if defined(__linux__) && !defined(SCHED_BATCH)
+#  define SCHED_BATCH           3   /* glibc hides it without _GNU_SOURCE */
+#endif /* __linux__ && !SCHED_BATCH */
+
+typedef struct
+{
+    char            name [ 32 ];
+    int             nice;           /* setpriority(), or CLASS_NO_NICE */
+    int             ioclass;        /* IOPRIO_CLASS_*, or 0 */
+    int             iolevel;        /* 0 (highest) to 7 */
+    BOOL            batch;          /* SCHED_BATCH */
+    int             active;         /* live sessions */
+    unsigned long   sessions;       /* ended sessions */
+    unsigned long   cpu_ms;         /* their user + system time */
+    unsigned long   wall_ms;        /* and elapsed time */
+} sched_class;
+
+
+extern sched_class  classes [ MAX_CLASSES ];
+extern int          nclasses;
+
+void    class_load   ( void );
+int     class_find   ( const char *name );
+void    class_apply  ( int cls );
+void    class_done   ( int cls, struct rusage *ru, struct timeval *start );
+void    class_report ( void );
+
+#endif /* _SCHED_CLASS_H */
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2001 QUALCOMM Incorporated.  All rights reserved.
+ * The file license.txt specifies the terms for use, modification,
+ * and redistribution.
+ *
+ * Shared-memory scoreboard for the standalone daemon.
+ *
+ * The daemon maps a file (named by the QPOP_SCOREBOARD environment
+ * variable) holding a fixed header followed by one slot per session
+ * child.  The header is SB_HDR_SIZE bytes and each slot SB_SLOT_SIZE
+ * bytes, so every slot starts on its own cache line and children
+ * updating neighbouring slots do not contend.
+ *
+ * Each slot has exactly one writer at a time: the master while the
+ * slot is free or being claimed, the child once it is running, and
+ * the master again after reaping the child.  Writers bracket their
+ * updates with sb_begin()/sb_end(), which make 'seq' odd while the
+ * slot is inconsistent; readers (popstat) retry until they see the
+ * same even 'seq' before and after copying the slot.  No locks.
+ *
+ * The event counters in the header are shared by every acceptor (and
+ * any that replace them after a crash), so they are only ever added
+ * to, atomically, with SB_COUNT().  accepts[] has one writer per entry.
+ */
+
+#ifndef _SCOREBOARD_H
+#define _SCOREBOARD_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#define SB_MAGIC            0x51534231UL    /* "QSB1" */
+#define SB_VERSION          5
+#define SB_LINE             64              /* cache line size */
+#define SB_HDR_SIZE         ( 8 * SB_LINE )
+#define SB_SLOT_SIZE        ( 2 * SB_LINE )
+#define SB_DEFAULT_SLOTS    1024
+#define SB_MAX_ACCEPTORS    32
+
+#define SB_CLIENT_LEN       46              /* INET6_ADDRSTRLEN */
+
+/*
+ * Slot states
+ */
+#define SB_FREE             0   /* unused */
+#define SB_STARTING         1   /* claimed by master, child not yet running */
+#define SB_RUNNING          2   /* child running Qpopper */
+
+#if defined(__GNUC__)
+#  define SB_BARRIER()      __sync_synchronize()
+#  define SB_COUNT(hdr,field,n) \
+                            ( (void) __sync_fetch_and_add ( &(hdr)->h.field, (n) ) )
+#else
+#  define SB_BARRIER()
+#  define SB_COUNT(hdr,field,n) \
+                            ( (void) ( (hdr)->h.field += (n) ) )
+#endif /* __GNUC__ */
+
+
+typedef union
+{
+    struct
+    {
+        volatile unsigned long  seq;
+        long                    pid;
+        time_t                  started;
+        int                     state;
+        int                     lst;            /* listener index */
+        int                     cls;            /* class index */
+        char                    client [ SB_CLIENT_LEN ];
+    } s;
+    char pad [ SB_SLOT_SIZE ];
+} sb_slot_t;
+
+
+typedef union
+{
+    struct
+    {
+        unsigned long           magic;
+        int                     version;
+        int                     nslots;
+        int                     hdr_size;
+        int                     slot_size;
+        long                    master_pid;
+        time_t                  started;
+        unsigned long           fork_failures;
+        unsigned long           overload_pauses;
+        unsigned long           acl_denied;
+        int                     nacceptors;
+        unsigned long           accepts [ SB_MAX_ACCEPTORS ];
+        unsigned long           fd_exhaustions;
+        unsigned long           errors_suppressed;
+        unsigned long           lifetime_kills;
+        unsigned long           forced_kills;
+        unsigned long           acceptor_restarts;
+    } h;
+    char pad [ SB_HDR_SIZE ];
+} sb_hdr_t;
+
+
+/*
+ * Fails to compile if the slot or header outgrows its padding
+ */
+typedef char sb_slot_fits [ sizeof(sb_slot_t) == SB_SLOT_SIZE ? 1 : -1 ];
+typedef char sb_hdr_fits  [ sizeof(sb_hdr_t)  == SB_HDR_SIZE  ? 1 : -1 ];
+
+
+#define SB_SLOT(hdr,i) \
+    ( (sb_slot_t *) ( (char *) (hdr) + SB_HDR_SIZE + (i) * SB_SLOT_SIZE ) )
+
+#define SB_SIZE(n)          ( SB_HDR_SIZE + (size_t) (n) * SB_SLOT_SIZE )
+
+#define sb_begin(sp)        do { (sp)->s.seq++; SB_BARRIER(); } while (0)
+#define sb_end(sp)          do { SB_BARRIER(); (sp)->s.seq++; } while (0)
+
+#endif /* _SCOREBOARD_H */
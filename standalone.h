@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2001 QUALCOMM Incorporated.  All rights reserved.
+ * The file license.txt specifies the terms for use, modification,
+ * and redistribution.
+ *
+ * Declarations shared by the parts of the standalone daemon: main.c
+ * (accept loop, listeners, logging, scoreboard) and the subsystems
+ * it uses (acl.c, children.c, proxy.c, rdns.c, sched_class.c,
+ * supervisor.c).  Include after popper.h and scoreboard.h.
+ */
+
+#ifndef _STANDALONE_H
+#define _STANDALONE_H
+
+/*
+ * Be careful using TRACE in an 'if' statement!
+ */
+#define TRACE if ( debug ) logit
+
+
+/*
+ * System prototypes (functions often missing prototypes in
+ * system header files)
+ */
+void bzero();
+pid_t wait3();
+
+
+/*
+ * Most acceptor processes sharing one listening address, and most
+ * listening addresses
+ */
+#define MAX_ACCEPTORS        SB_MAX_ACCEPTORS
+#define MAX_LISTENERS          16
+
+/*
+ * listen() backlog unless a listener asks for another
+ */
+#define LISTEN_BACKLOG          5
+
+/*
+ * An address we accept connections on, with its own policy (see
+ * parse_listeners()).  Each acceptor has its own socket for it.
+ */
+typedef struct
+{
+    struct sockaddr_storage addr;
+    socklen_t       addrlen;
+    char            name [ 64 ];    /* "addr:port", for messages */
+    int             backlog;        /* listen() queue length */
+    int             max_children;   /* sessions at once; 0 = no limit */
+    int             cls;            /* scheduling class */
+    BOOL            proxy;          /* connections start with a PROXY header */
+    int             argc;           /* for Qpopper */
+    char          **argv;
+    int             fds [ MAX_ACCEPTORS ];
+    int             fd;             /* this acceptor's socket */
+    int             nchildren;      /* this acceptor's live sessions */
+    BOOL            full;           /* at max_children */
+    unsigned long   accepted;
+    unsigned long   denied;
+    unsigned long   forked;
+    unsigned long   fork_failed;
+    unsigned long   full_count;     /* times accept stopped at max */
+} listener;
+
+
+/*
+ * In main.c
+ */
+void    msg      ( WHENCE, const char *format, ... );
+void    err_msg  ( WHENCE, const char *format, ... );
+void    err_dump ( WHENCE, const char *format, ... );
+int     reaper  ( SIGPARAM );
+int     hupit   ( SIGPARAM );
+int     cleanup ( SIGPARAM );
+void    admit        ( int newsockfd, listener *l, struct sockaddr *cli_addr,
+                       struct timeval *accepted );
+char   *addr_str          ( struct sockaddr *sa, char *buf, size_t size,
+                            BOOL port );
+void    close_listeners   ( void );
+void    roll_it ( void );
+long    env_long   ( const char *name, long dflt );
+void    sb_release ( int slot, pid_t pid );
+void    arrival_open   ( void );
+void    arrival_done   ( pid_t pid, struct timeval *start );
+
+extern volatile BOOL    bClean;
+extern volatile BOOL    bRollover;
+extern volatile BOOL    bReap;
+extern BOOL             debug;
+extern FILE            *trace_file;
+extern sb_hdr_t        *sb_hdr;
+extern int              sb_nslots;
+extern int              reserve_fd;
+extern int              arrival_fd;
+extern int              nacceptors;
+extern int              acceptor_id;
+extern listener         listeners [ MAX_LISTENERS ];
+extern int              nlisteners;
+extern unsigned long    accept_count;
+
+#endif /* _STANDALONE_H */
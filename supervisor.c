@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2001 QUALCOMM Incorporated.  All rights reserved.
+ * The file license.txt specifies the terms for use, modification,
+ * and redistribution.
+ *
+ * The standalone daemon's acceptor processes ($QPOP_ACCEPTORS), how
+ * connections are steered among them ($QPOP_STEER), and the supervisor
+ * that restarts them ($QPOP_SUPERVISE).  See start_acceptors() and
+ * supervise().
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <sys/errno.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <sys/time.h>
+#ifdef __linux__
+#  include <linux/filter.h>
+#  include <sys/prctl.h>
+#endif /* __linux__ */
+#include <sys/socket.h> /* this needs to be after other .h files */
+
+#include "config.h"
+#include "popper.h"
+#include "snprintf.h"
+#include "logit.h"
+#include "scoreboard.h"
+#include "standalone.h"
+#include "supervisor.h"
+#include "acl.h"
+#include "children.h"
+
+#if HAVE_UNISTD_H
+#  include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_SYS_UNISTD_H
+#  include <sys/unistd.h>
+#endif /* HAVE_SYS_UNISTD_H */
+
+#ifdef HAVE_FCNTL_H
+#  include <fcntl.h>
+#endif /* HAVE_FCNTL_H */
+
+#ifdef HAVE_SYS_FCNTL_H
+#  include <sys/fcntl.h>
+#endif /* HAVE_SYS_FCNTL_H */
+
+
+#ifdef STANDALONE
+
+/*
+ * Globals
+ */
+pid_t           acceptor_pids [ MAX_ACCEPTORS ];
+acceptor_info   acceptors     [ MAX_ACCEPTORS ];    /* supervisor only */
+unsigned long   acceptor_restarts = 0;
+
+
+/*
+ * Attaches a classic BPF program to the SO_REUSEPORT group 'fd' is in,
+ * choosing which of the 'n' acceptors gets each connection, according
+ * to $QPOP_STEER:
+ *
+ *     hash    by client address, so a client keeps going to the
+ *             same acceptor
+ *     cpu     by the CPU that received the connection
+ *
+ * Otherwise the kernel's default (4-tuple hash) is left in place.  The
+ * program returns an index into the group, i.e., the order the
+ * sockets were bound in, which is also the acceptor id.  It is a
+ * fixed classic BPF program, not eBPF, so it can't look the group up:
+ * it assumes all 'n' sockets stay in it.  Without a supervisor a dead
+ * acceptor's socket closes and the group shrinks, and the kernel then
+ * quietly ignores the program's answer and falls back to its hash.
+ * So $QPOP_STEER needs $QPOP_SUPERVISE, whose supervisor holds every
+ * socket for as long as the daemon runs.
+ */
+void
+steer_acceptors ( int fd, int family, int n )
+{
+    char *mode = getenv ( "QPOP_STEER" );
+
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(__linux__)
+    struct sock_filter  code [ 8 ];
+    struct sock_fprog   prog;
+    int                 len  = 0;
+
+
+    if ( mode == NULL || *mode == '\0' )
+        return;
+
+    if ( env_long ( "QPOP_SUPERVISE", 0 ) == 0 )
+        err_dump ( HERE, "QPOP_STEER needs QPOP_SUPERVISE" );
+
+    if ( strcmp ( mode, "hash" ) == 0 )
+    {
+        /*
+         * A = low word of the source address (IPv4: saddr at offset
+         * 12 of the IP header; IPv6: last word of saddr, offset 20),
+         * scrambled with a multiplicative hash.
+         */
+        code [ len++ ] = (struct sock_filter)
+            BPF_STMT ( BPF_LD  | BPF_W   | BPF_ABS,
+                       SKF_NET_OFF + ( family == AF_INET6 ? 20 : 12 ) );
+        code [ len++ ] = (struct sock_filter)
+            BPF_STMT ( BPF_ALU | BPF_MUL | BPF_K, 2654435761U );
+        code [ len++ ] = (struct sock_filter)
+            BPF_STMT ( BPF_ALU | BPF_RSH | BPF_K, 16 );
+    }
+    else
+    if ( strcmp ( mode, "cpu" ) == 0 )
+    {
+        code [ len++ ] = (struct sock_filter)
+            BPF_STMT ( BPF_LD  | BPF_W   | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU );
+    }
+    else
+        err_dump ( HERE, "QPOP_STEER must be \"hash\" or \"cpu\", not \"%s\"",
+                   mode );
+
+    code [ len++ ] = (struct sock_filter)
+        BPF_STMT ( BPF_ALU | BPF_MOD | BPF_K, n );
+    code [ len++ ] = (struct sock_filter)
+        BPF_STMT ( BPF_RET | BPF_A, 0 );
+
+    prog.len    = len;
+    prog.filter = code;
+    if ( setsockopt ( fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                      (char *) &prog, sizeof(prog) ) == -1 )
+        err_dump ( HERE, "Unable to attach %s steering program", mode );
+
+    msg ( HERE, "steering connections to %d acceptors by %s", n, mode );
+#else
+    if ( mode != NULL && *mode != '\0' )
+        msg ( HERE, "QPOP_STEER not supported on this platform; ignored" );
+#endif /* SO_ATTACH_REUSEPORT_CBPF && __linux__ */
+}
+
+
+/*
+ * Forks acceptors 1 to nacceptors-1, or, with $QPOP_SUPERVISE, all of
+ * them from a supervisor (see supervise()).  Each acceptor keeps only
+ * its own listening socket for each listener.
+ */
+void
+start_acceptors ( void )
+{
+    listener *l   = NULL;
+    pid_t     pid = 0;
+    int       i   = 0;
+    int       j   = 0;
+
+
+    if ( env_long ( "QPOP_SUPERVISE", 0 ) != 0 )
+        supervise();    /* returns only in an acceptor */
+    else
+    {
+        for ( i = 1; i < nacceptors; i++ )
+        {
+            pid = fork_acceptor ( i );
+            if ( pid == 0 )
+                break;
+
+            if ( pid == -1 )
+            {
+                err_msg ( HERE, "Unable to start acceptor %d", i );
+                for ( j = 0; j < nlisteners; j++ )
+                {
+                    close ( listeners [ j ].fds [ i ] );
+                    listeners [ j ].fds [ i ] = -1;
+                }
+            }
+        }
+    }
+
+    for ( j = 0; j < nlisteners; j++ )
+    {
+        l = &listeners [ j ];
+        for ( i = 0; i < nacceptors; i++ )
+        {
+            if ( i != acceptor_id && l->fds [ i ] != -1 )
+            {
+                close ( l->fds [ i ] );
+                l->fds [ i ] = -1;
+            }
+        }
+        l->fd = l->fds [ acceptor_id ];
+    }
+}
+
+
+/*
+ * Forks acceptor 'i'.  Returns as fork() does.
+ */
+pid_t
+fork_acceptor ( int i )
+{
+    pid_t pid = fork();
+
+
+    if ( pid == 0 )
+    {
+        acceptor_id = i;
+        memset ( acceptor_pids, 0, sizeof(acceptor_pids) );
+        return 0;
+    }
+
+    if ( pid > 0 )
+    {
+        acceptor_pids [ i ] = pid;
+        gettimeofday ( &acceptors [ i ].started, NULL );
+        TRACE ( trace_file, POP_DEBUG, HERE, "started acceptor %d; pid=%d",
+                i, (int) pid );
+    }
+    return pid;
+}
+
+
+/*
+ * Passes a signal on to the acceptors we started (acceptor 0 or the
+ * supervisor only).
+ */
+void
+signal_acceptors ( int sig )
+{
+    int i = 0;
+
+
+    for ( i = 0; i < nacceptors; i++ )
+        if ( acceptor_pids [ i ] > 0 )
+            kill ( acceptor_pids [ i ], sig );
+}
+
+
+/*
+ * With $QPOP_SUPERVISE set, the process that bound the listening
+ * sockets stays on as a small supervisor.  It holds every socket,
+ * forks all the acceptors (acceptor 0 too), and forks a fresh one as
+ * soon as one dies, e.g., in err_dump(), so the port is never left
+ * unserved; connections arriving meanwhile wait in the listen queue.
+ * Sessions of a dead acceptor carry on; its replacement finds them in
+ * the scoreboard and adopts them (see sb_adopt()), so they still count
+ * against its budgets and limits.  On Linux the supervisor is their
+ * subreaper, so they are reaped here rather than by init.
+ *
+ * An acceptor that dies within RESPAWN_STABLE seconds of starting is
+ * restarted after RESPAWN_MIN_DELAY ms, doubling up to
+ * RESPAWN_MAX_DELAY while it keeps dying, so a crash loop doesn't
+ * spin.  SIGHUP and SIGTERM are passed on to the acceptors.
+ *
+ * Returns only in a newly forked acceptor.
+ */
+void
+supervise ( void )
+{
+    sigset_t         block;
+    sigset_t         oldmask;
+    struct timeval   now;
+    struct timeval   next;
+    struct timespec  ts;
+    struct timespec *tsp  = NULL;
+    pid_t            pid  = 0;
+    int              i    = 0;
+
+
+    /*
+     * Signals are only let in while we wait in pselect(), so one can't
+     * slip in between checking the flags and waiting.
+     */
+    sigemptyset ( &block );
+    sigaddset   ( &block, SIGCHLD );
+    sigaddset   ( &block, SIGHUP  );
+    sigaddset   ( &block, SIGTERM );
+    sigprocmask ( SIG_BLOCK, &block, &oldmask );
+
+    signal ( SIGCHLD, VOIDSTAR reaper  );
+    signal ( SIGHUP,  VOIDSTAR hupit   );
+    signal ( SIGTERM, VOIDSTAR cleanup );
+
+#ifdef    PR_SET_CHILD_SUBREAPER
+    if ( prctl ( PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0 ) == -1 )
+        TRACE ( trace_file, POP_DEBUG, HERE, "unable to become subreaper: %s",
+                STRERROR(errno) );
+#endif /* PR_SET_CHILD_SUBREAPER */
+
+    msg ( HERE, "supervising %d acceptor(s)", nacceptors );
+
+    while ( TRUE )
+    {
+        if ( bClean )
+        {
+            msg   ( HERE, "supervisor cleaning up and exiting normally" );
+            signal_acceptors ( SIGTERM );
+            close_listeners();
+            if ( trace_file != NULL )
+            {
+                fclose ( trace_file );
+                trace_file = NULL;
+            }
+            exit  ( 0 );
+        }
+
+        if ( bReap )
+            supervisor_reap();
+
+        if ( bRollover )
+        {
+            /*
+             * Also pick up the new log files and access rules, for
+             * acceptors we start from now on
+             */
+            signal_acceptors ( SIGHUP );
+            roll_it();
+            arrival_open();
+            acl_reload();
+            supervisor_report();
+            bRollover = FALSE;
+            signal ( SIGHUP,  VOIDSTAR hupit   );
+        }
+
+        /*
+         * Start any acceptors that are due, and see when the next is
+         */
+        gettimeofday ( &now, NULL );
+        tsp = NULL;
+        for ( i = 0; i < nacceptors; i++ )
+        {
+            if ( acceptor_pids [ i ] != 0 )
+                continue;
+
+            if ( timercmp ( &acceptors [ i ].due, &now, > ) )
+            {
+                if ( tsp == NULL || timercmp ( &acceptors [ i ].due, &next, < ) )
+                {
+                    next = acceptors [ i ].due;
+                    tsp  = &ts;
+                }
+                continue;
+            }
+
+            pid = fork_acceptor ( i );
+            if ( pid == 0 )
+            {
+                sigprocmask ( SIG_SETMASK, &oldmask, NULL );
+                if ( sb_hdr != NULL )
+                    accept_count = sb_hdr->h.accepts [ i ];
+                wheel_now = time ( NULL );
+                sb_adopt();
+                return;
+            }
+
+            if ( pid == -1 )
+            {
+                err_msg ( HERE, "Unable to start acceptor %d", i );
+                respawn_after ( i, FALSE );
+                i--;    /* to pick up its new time */
+            }
+        }
+
+        if ( tsp != NULL )
+        {
+            timersub ( &next, &now, &next );
+            ts.tv_sec  = next.tv_sec;
+            ts.tv_nsec = next.tv_usec * 1000;
+        }
+
+        if ( pselect ( 0, NULL, NULL, NULL, tsp, &oldmask ) == -1 &&
+             errno != EINTR )
+            err_msg ( HERE, "pselect() error" );
+    }
+}
+
+
+/*
+ * Collects acceptors that exited and schedules their restart.  Sessions
+ * orphaned to us (see supervise()) are just reaped.
+ */
+void
+supervisor_reap ( void )
+{
+    int             stts      = 0;
+    pid_t           child_pid = 0;
+    int             i         = 0;
+    struct timeval  now;
+
+
+    bReap = FALSE;
+
+    while ( ( child_pid = wait3 ( &stts, WNOHANG, NULL ) ) > 0 )
+    {
+        for ( i = 0; i < nacceptors; i++ )
+            if ( acceptor_pids [ i ] == child_pid )
+                break;
+        if ( i == nacceptors )
+            continue;
+
+        acceptor_pids [ i ] = 0;
+        acceptors [ i ].restarts++;
+        acceptor_restarts++;
+        if ( sb_hdr != NULL )
+            SB_COUNT ( sb_hdr, acceptor_restarts, 1 );
+
+        gettimeofday ( &now, NULL );
+        respawn_after ( i, now.tv_sec - acceptors [ i ].started.tv_sec
+                           >= RESPAWN_STABLE );
+
+        if ( acceptors [ i ].delay == 0 )
+            msg ( HERE, "acceptor %d (pid %d) exited; status %#x; restarting",
+                  i, (int) child_pid, stts );
+        else
+            msg ( HERE, "acceptor %d (pid %d) exited; status %#x; "
+                        "restarting in %ld ms",
+                  i, (int) child_pid, stts, acceptors [ i ].delay );
+    }
+
+    signal ( SIGCHLD, VOIDSTAR reaper );
+}
+
+
+/*
+ * Sets when acceptor 'i' may be started again: at once if it ran
+ * for a while ('stable'), otherwise after a growing delay.
+ */
+void
+respawn_after ( int i, BOOL stable )
+{
+    acceptor_info *a = &acceptors [ i ];
+
+
+    if ( stable )
+        a->delay = 0;
+    else
+    if ( a->delay == 0 )
+        a->delay = RESPAWN_MIN_DELAY;
+    else
+    if ( a->delay < RESPAWN_MAX_DELAY )
+    {
+        a->delay *= 2;
+        if ( a->delay > RESPAWN_MAX_DELAY )
+            a->delay = RESPAWN_MAX_DELAY;
+    }
+
+    gettimeofday ( &a->due, NULL );
+    a->due.tv_sec  += a->delay / 1000;
+    a->due.tv_usec += ( a->delay % 1000 ) * 1000;
+    if ( a->due.tv_usec >= 1000000 )
+    {
+        a->due.tv_sec++;
+        a->due.tv_usec -= 1000000;
+    }
+}
+
+
+/*
+ * Logs acceptor restarts
+ */
+void
+supervisor_report ( void )
+{
+    int i = 0;
+
+
+    msg ( HERE, "supervisor: %lu acceptor restarts", acceptor_restarts );
+    for ( i = 0; i < nacceptors; i++ )
+        if ( acceptors [ i ].restarts > 0 )
+            msg ( HERE, "acceptor %d: restarted %lu times; now pid %d",
+                  i, acceptors [ i ].restarts, (int) acceptor_pids [ i ] );
+}
+
+#endif /* STANDALONE */
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2001 QUALCOMM Incorporated.  All rights reserved.
+ * The file license.txt specifies the terms for use, modification,
+ * and redistribution.
+ *
+ * The standalone daemon's acceptor processes ($QPOP_ACCEPTORS), how
+ * connections are steered among them ($QPOP_STEER), and the supervisor
+ * that restarts them ($QPOP_SUPERVISE).  See start_acceptors() and
+ * supervise().
+ */
+
+#ifndef _SUPERVISOR_H
+#define _SUPERVISOR_H
+
+/*
+ * Under a supervisor: how long to wait before restarting an acceptor
+ * that keeps dying (milliseconds, doubling each time), and how long
+ * one must have run (seconds) to be restarted at once
+ */
+#define RESPAWN_MIN_DELAY     100
+#define RESPAWN_MAX_DELAY   30000
+#define RESPAWN_STABLE         10
+
+typedef struct
+{
+    struct timeval  started;
+    struct timeval  due;            /* don't restart before this */
+    long            delay;          /* current back-off, ms */
+    unsigned long   restarts;
+} acceptor_info;
+
+
+extern pid_t        acceptor_pids [ MAX_ACCEPTORS ];
+
+void    steer_acceptors   ( int fd, int family, int n );
+void    start_acceptors   ( void );
+pid_t   fork_acceptor     ( int i );
+void    signal_acceptors  ( int sig );
+void    supervise         ( void );
+void    supervisor_reap   ( void );
+void    respawn_after     ( int i, BOOL stable );
+void    supervisor_report ( void );
+
+#endif /* _SUPERVISOR_H */